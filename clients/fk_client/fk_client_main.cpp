@@ -1,47 +1,62 @@
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <boost/asio.hpp>
-#include <boost/beast/http.hpp>
-#include <boost/beast/core/flat_buffer.hpp>          // for flat_buffer
-#include <boost/beast/core/buffers_to_string.hpp>    // if you use buffers_to_string
 
 #include <nlohmann/json.hpp>
-#include <chrono>
+#include "client/http_client.hpp"
 
-namespace http = boost::beast::http;
 using json = nlohmann::json;
+namespace http = boost::beast::http;
 
 int main(int argc, char **argv)
 {
     std::string base = "http://localhost:8080";
+    int count = 50;
+    int period_ms = 100;
     for (int i = 1; i < argc; ++i)
     {
         std::string a = argv[i];
         if (a == "--http" && i + 1 < argc)
             base = argv[++i];
+        else if (a == "--count" && i + 1 < argc)
+            count = std::stoi(argv[++i]);
+        else if (a == "--period-ms" && i + 1 < argc)
+            period_ms = std::stoi(argv[++i]);
     }
-    // POST /v1/pose/update periodically
+
+    // POST /v1/pose/update periodically over one pooled keep-alive client
     boost::asio::io_context ioc;
-    boost::asio::ip::tcp::resolver res{ioc};
-    auto pos = base.find("//");
-    auto hp = base.substr(pos + 2);
-    auto host = hp.substr(0, hp.find(":"));
-    auto port = hp.substr(host.size() + 1);
-    auto results = res.resolve(host, port);
-    for (int k = 0; k < 50; ++k)
+    auto guard = boost::asio::make_work_guard(ioc);
+    std::thread io([&] { ioc.run(); });
+
+    auto http_client = client::HttpClient::create(ioc, client::parse_url(base));
+    std::atomic<int> ok{0}, failed{0}, done{0};
+    for (int k = 0; k < count; ++k)
     {
-        boost::asio::ip::tcp::socket sock{ioc};
-        boost::asio::connect(sock, results.begin(), results.end());
-        http::request<http::string_body> req{http::verb::post, "/v1/pose/update", 11};
-        req.set(http::field::host, host);
-        req.set(http::field::content_type, "application/json");
         json j{{"p", {0.01 * k, 0.0, 0.0}}, {"R", {1, 0, 0, 0, 1, 0, 0, 0, 1}}, {"source", "fk"}};
-        req.body() = j.dump();
-        req.prepare_payload();
-        http::write(sock, req);
-        boost::beast::flat_buffer buf;
-        http::response<http::string_body> res;
-        http::read(sock, buf, res);
-        sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        http_client->async_request(http_client->make(http::verb::post, "/v1/pose/update", j.dump()),
+                                   [&](boost::beast::error_code ec, client::Response res)
+                                   {
+                                       if (ec || res.result_int() >= 400)
+                                       {
+                                           if (failed++ == 0)
+                                               std::cerr << "fk: pose update failed: "
+                                                         << (ec ? ec.message() : std::to_string(res.result_int())) << "\n";
+                                       }
+                                       else
+                                           ++ok;
+                                       ++done;
+                                   });
+        std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
     }
-}
\ No newline at end of file
+    while (done < count)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::cerr << "fk: " << ok << " updates accepted, " << failed << " failed\n";
+
+    http_client->shutdown();
+    guard.reset();
+    io.join();
+    return failed ? 1 : 0;
+}
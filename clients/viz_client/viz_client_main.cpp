@@ -1,19 +1,47 @@
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
 #include <boost/asio.hpp>
-#include <boost/beast/websocket.hpp>
 #include <nlohmann/json.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
+#include "client/ws_client.hpp"
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
-namespace websocket = boost::beast::websocket;
+
+// One line per preview: totals, then per coil RMS/peak and a magnitude sparkline.
+static void print_preview(const json &p)
+{
+    static const char ramp[] = " .:-=+*#%@";
+    std::cout << "viz preview idx=" << p.value("idx", json()).dump() << " acqs=" << p.value("acqs", 0)
+              << " saturated=" << p.value("saturated", 0) << " [" << p.value("isa", std::string()) << "]\n";
+    int c = 0;
+    for (auto &coil : p.value("coils", json::array()))
+    {
+        if (!coil.is_object())
+            continue;
+        std::string spark;
+        for (auto &v : coil.value("profile", json::array()))
+        {
+            // profile values are 0-255: clamp out-of-range ones, mark non-integers with '?'
+            if (!v.is_number_integer())
+            {
+                spark += '?';
+                continue;
+            }
+            spark += ramp[std::clamp<int64_t>(v.get<int64_t>(), 0, 255) * 9 / 255];
+        }
+        std::cout << "  c" << c++ << " rms=" << coil.value("rms", 0.0) << " peak=" << coil.value("peak", 0.0)
+                  << " sat=" << coil.value("sat", 0) << " |" << spark << "|\n";
+    }
+}
 
 int main(int argc, char **argv)
 {
     std::string ws_url = "ws://localhost:8090/ws";
     std::string data = "/data";
+    size_t last = 20;
+    std::string topics = "mrd.preview"; // comma-separated; "all" = every topic
     for (int i = 1; i < argc; ++i)
     {
         std::string a = argv[i];
@@ -21,6 +49,10 @@ int main(int argc, char **argv)
             ws_url = argv[++i];
         else if (a == "--data" && i + 1 < argc)
             data = argv[++i];
+        else if (a == "--last" && i + 1 < argc)
+            last = std::stoull(argv[++i]);
+        else if (a == "--topics" && i + 1 < argc)
+            topics = argv[++i];
     }
 
     // watch latest.json (polling)
@@ -34,28 +66,57 @@ int main(int argc, char **argv)
     lf >> lj;
     std::cout << "viz: latest=" << lj.dump() << "\n";
 
-    // connect WS and print incoming pose/acq
-    boost::asio::io_context ioc;
-    boost::asio::ip::tcp::resolver res{ioc};
-    auto pos = ws_url.find("//");
-    auto hp = ws_url.substr(pos + 2);
-    auto slash = hp.find("/");
-    auto host = hp.substr(0, hp.find(":"));
-    auto port = hp.substr(host.size() + 1, slash - host.size() - 1);
-    auto target = hp.substr(slash);
-    auto const results = res.resolve(host, port);
-    boost::asio::ip::tcp::socket sock{ioc};
-    boost::asio::connect(sock, results.begin(), results.end());
-    websocket::stream<boost::asio::ip::tcp::socket> ws{std::move(sock)};
-    ws.handshake(host, target);
-    boost::beast::flat_buffer buf;
-    while (true)
+    json want = json::array();
+    for (size_t p = 0; topics != "all" && p <= topics.size();)
     {
-        ws.read(buf);
-        auto s = boost::beast::buffers_to_string(buf.data());
-        buf.consume(buf.size());
-        auto j = json::parse(s, nullptr, false);
-        if (j.is_object())
-            std::cout << "viz got: " << j.dump() << "\n";
+        auto q = std::min(topics.find(',', p), topics.size());
+        if (q > p)
+            want.push_back(topics.substr(p, q - p));
+        p = q + 1;
     }
-}
\ No newline at end of file
+
+    // connect WS and print incoming frames; stays connected across marshal restarts
+    boost::asio::io_context ioc;
+    auto ws = client::WsClient::create(ioc, client::parse_url(ws_url));
+    uint64_t seen = 0;  // last seq printed, so a reconnect resumes instead of repeating
+    std::string epoch; // marshal log epoch `seen` belongs to
+    ws->on_connect([&]
+                   {
+                       // catch up on the most recent frames before going live
+                       json sub{{"op", "subscribe"}, {"topics", want}};
+                       if (seen)
+                           sub["from_seq"] = seen + 1;
+                       else
+                           sub["last"] = last;
+                       return std::vector<std::string>{sub.dump()}; });
+    ws->on_status([&](bool up, boost::beast::error_code ec)
+                  { std::cerr << "viz: " << (up ? "connected to " + ws_url : "disconnected: " + ec.message()) << "\n"; });
+    ws->on_message([&](std::string s)
+                   {
+                       auto j = json::parse(s, nullptr, false);
+                       if (!j.is_object())
+                           return;
+                       const std::string topic = j.contains("topic") && j["topic"].is_string() ? j["topic"].get<std::string>() : "";
+                       // a marshal restarted without --ws-log numbers from 1 again under a new epoch
+                       if (topic == "ws.subscribed")
+                       {
+                           const json &p = j["payload"];
+                           const uint64_t head = p.is_object() && p.contains("head_seq") && p["head_seq"].is_number_unsigned() ? p["head_seq"].get<uint64_t>() : seen;
+                           const std::string now = p.is_object() && p.contains("epoch") && p["epoch"].is_string() ? p["epoch"].get<std::string>() : epoch;
+                           const bool restarted = (!epoch.empty() && now != epoch) || head < seen;
+                           epoch = now;
+                           if (restarted)
+                           {
+                               seen = 0;
+                               ws->send(json{{"op", "subscribe"}, {"topics", want}, {"from_seq", 1}}.dump());
+                           }
+                       }
+                       if (j.contains("seq") && j["seq"].is_number_unsigned())
+                           seen = std::max(seen, j["seq"].get<uint64_t>());
+                       if (topic == "mrd.preview" && j["payload"].is_object())
+                           print_preview(j["payload"]);
+                       else
+                           std::cout << "viz got: " << j.dump() << "\n"; });
+    ws->start();
+    ioc.run();
+}
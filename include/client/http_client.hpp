@@ -0,0 +1,279 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "client/url.hpp"
+#include "client/tuning.hpp"
+
+// Asynchronous HTTP/1.1 client with a keep-alive connection pool.
+//
+// Requests go to the least loaded open connection; up to max_pipeline of
+// them are written back-to-back on one connection before the responses are
+// read (responses arrive in request order). A new connection is opened while
+// every open one is busy and fewer than max_connections exist; beyond that
+// requests wait in the client. When a connection fails, requests that were
+// not written yet and idempotent requests are retried on another connection;
+// the rest complete with the error. Handlers run on the client's strand.
+
+namespace client {
+
+namespace http = boost::beast::http;
+using Request         = http::request<http::string_body>;
+using Response        = http::response<http::string_body>;
+using ResponseHandler = std::function<void(boost::beast::error_code, Response)>;
+
+struct HttpOptions {
+    size_t max_connections{4};
+    size_t max_pipeline{8};                      // requests in flight per connection
+    std::chrono::milliseconds timeout{10000};    // per write / response
+    std::chrono::milliseconds idle_close{30000}; // below the server's idle timeout
+    unsigned retries{1};                         // re-sends after a connection loss
+    SocketTuning tuning{};
+};
+
+class HttpClient : public std::enable_shared_from_this<HttpClient> {
+    using tcp = boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+
+    struct Pending {
+        std::shared_ptr<Request> req;
+        ResponseHandler handler;
+        unsigned attempts{0};
+    };
+
+    struct Conn {
+        explicit Conn(boost::asio::strand<boost::asio::io_context::executor_type> ex) : stream(ex) {}
+        boost::beast::tcp_stream stream;
+        boost::beast::flat_buffer buffer;
+        std::optional<http::response_parser<http::string_body>> parser;
+        std::deque<Pending> to_write;  // queued on this connection, not written yet
+        std::deque<Pending> awaiting;  // written, response pending (in order)
+        bool open{false};
+        bool writing{false};
+        bool reading{false};
+        bool dead{false};
+        clock::time_point last_used{clock::now()};
+        size_t load() const { return to_write.size() + awaiting.size(); }
+    };
+    using ConnPtr = std::shared_ptr<Conn>;
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    Url base_;
+    HttpOptions opt_;
+    tcp::resolver resolver_;
+    std::optional<tcp::resolver::results_type> endpoints_;
+    std::vector<ConnPtr> conns_;
+    std::deque<Pending> waiting_;  // every connection full
+
+    HttpClient(boost::asio::io_context& ioc, Url base, HttpOptions opt)
+        : strand_(boost::asio::make_strand(ioc)), base_(std::move(base)), opt_(opt), resolver_(strand_) {
+        opt_.max_connections = std::max<size_t>(opt_.max_connections, 1);
+        opt_.max_pipeline    = std::max<size_t>(opt_.max_pipeline, 1);
+    }
+
+public:
+    static std::shared_ptr<HttpClient> create(boost::asio::io_context& ioc, Url base, HttpOptions opt = {}) {
+        return std::shared_ptr<HttpClient>(new HttpClient(ioc, std::move(base), opt));
+    }
+
+    const Url& base() const { return base_; }
+
+    // Builds a request against the base URL; the target is appended to its path.
+    Request make(http::verb verb, const std::string& target, std::string body = {},
+                 const char* content_type = "application/json") const {
+        std::string t = base_.target == "/" ? target : base_.target + target;
+        Request req{verb, t, 11};
+        req.set(http::field::host, base_.authority());
+        req.keep_alive(true);
+        if (verb != http::verb::get && verb != http::verb::head) {
+            req.set(http::field::content_type, content_type);
+            req.body() = std::move(body);
+        }
+        req.prepare_payload();
+        return req;
+    }
+
+    // Thread-safe.
+    void async_request(Request req, ResponseHandler handler) {
+        auto self = shared_from_this();
+        auto p = std::make_shared<Request>(std::move(req));
+        boost::asio::post(strand_, [self, p, h = std::move(handler)]() mutable {
+            self->dispatch(Pending{std::move(p), std::move(h)});
+        });
+    }
+
+    // For callers that do not run the io_context themselves.
+    std::future<Response> request(Request req) {
+        auto pr  = std::make_shared<std::promise<Response>>();
+        auto fut = pr->get_future();
+        async_request(std::move(req), [pr](boost::beast::error_code ec, Response res) {
+            if (ec) pr->set_exception(std::make_exception_ptr(boost::system::system_error(ec)));
+            else pr->set_value(std::move(res));
+        });
+        return fut;
+    }
+
+    // Closes every connection; queued requests complete with operation_aborted.
+    void shutdown() {
+        boost::asio::post(strand_, [self = shared_from_this()] {
+            for (auto& c : self->conns_) self->drop(c, boost::asio::error::operation_aborted, false);
+            self->conns_.clear();
+            for (auto& p : self->waiting_) p.handler(boost::asio::error::operation_aborted, {});
+            self->waiting_.clear();
+        });
+    }
+
+private:
+    static bool idempotent(const Request& r) {
+        auto v = r.method();
+        return v == http::verb::get || v == http::verb::head || v == http::verb::put ||
+               v == http::verb::delete_ || v == http::verb::options;
+    }
+
+    void dispatch(Pending p) {
+        const auto now = clock::now();
+        // retire connections the server may be about to close as idle
+        for (auto& c : conns_)
+            if (c->open && !c->load() && now - c->last_used > opt_.idle_close) drop(c, {}, false);
+        std::erase_if(conns_, [](const ConnPtr& c) { return c->dead; });
+
+        ConnPtr best;
+        for (auto& c : conns_)
+            if (c->load() < opt_.max_pipeline && (!best || c->load() < best->load())) best = c;
+        if ((!best || best->load() > 0) && conns_.size() < opt_.max_connections) best = connect();
+        if (!best) return waiting_.push_back(std::move(p));
+
+        best->to_write.push_back(std::move(p));
+        if (best->open) do_write(best);
+    }
+
+    bool has_capacity() const {
+        if (conns_.size() < opt_.max_connections) return true;
+        return std::any_of(conns_.begin(), conns_.end(),
+                           [&](const ConnPtr& c) { return !c->dead && c->load() < opt_.max_pipeline; });
+    }
+
+    void pump() {
+        while (!waiting_.empty() && has_capacity()) {
+            auto p = std::move(waiting_.front());
+            waiting_.pop_front();
+            dispatch(std::move(p));
+        }
+    }
+
+    ConnPtr connect() {
+        auto c = std::make_shared<Conn>(strand_);
+        conns_.push_back(c);
+        auto self = shared_from_this();
+        auto on_resolved = [self, c](boost::beast::error_code ec) {
+            if (ec) return self->fail(c, ec);
+            c->stream.expires_after(self->opt_.timeout);
+            c->stream.async_connect(*self->endpoints_, [self, c](boost::beast::error_code ec, auto) {
+                if (ec) return self->fail(c, ec);
+                apply(c->stream.socket(), self->opt_.tuning);
+                c->open = true;
+                c->last_used = clock::now();
+                self->do_write(c);
+            });
+        };
+        if (endpoints_) {
+            boost::asio::post(strand_, [on_resolved] { on_resolved({}); });
+        } else {
+            resolver_.async_resolve(base_.host, base_.port,
+                                    [self, on_resolved](boost::beast::error_code ec, tcp::resolver::results_type r) {
+                                        if (!ec) self->endpoints_ = std::move(r);
+                                        on_resolved(ec);
+                                    });
+        }
+        return c;
+    }
+
+    void do_write(const ConnPtr& c) {
+        if (c->writing || c->dead || c->to_write.empty()) return;
+        c->writing = true;
+        auto req = c->to_write.front().req;
+        c->stream.expires_after(opt_.timeout);
+        http::async_write(c->stream, *req, [self = shared_from_this(), c, req](boost::beast::error_code ec, size_t) {
+            c->writing = false;
+            if (c->dead) return;
+            if (ec) return self->fail(c, ec);
+            c->awaiting.push_back(std::move(c->to_write.front()));
+            c->to_write.pop_front();
+            self->do_read(c);
+            self->do_write(c);
+        });
+    }
+
+    void do_read(const ConnPtr& c) {
+        if (c->reading || c->dead || c->awaiting.empty()) return;
+        c->reading = true;
+        c->parser.emplace();
+        c->parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+        if (c->awaiting.front().req->method() == http::verb::head) c->parser->skip(true);
+        c->stream.expires_after(opt_.timeout);
+        http::async_read(c->stream, c->buffer, *c->parser, [self = shared_from_this(), c](boost::beast::error_code ec, size_t) {
+            c->reading = false;
+            if (c->dead) return;
+            if (ec) return self->fail(c, ec);
+            auto res = c->parser->release();
+            auto p   = std::move(c->awaiting.front());
+            c->awaiting.pop_front();
+            c->last_used = clock::now();
+            const bool reusable = res.keep_alive();
+            p.handler({}, std::move(res));
+            if (!reusable) {
+                self->drop(c, {}, true);
+                std::erase_if(self->conns_, [](const ConnPtr& x) { return x->dead; });
+            } else {
+                self->do_read(c);
+            }
+            self->pump();
+        });
+    }
+
+    void fail(const ConnPtr& c, boost::beast::error_code ec) {
+        drop(c, ec, true);
+        std::erase_if(conns_, [](const ConnPtr& x) { return x->dead; });
+        pump();
+    }
+
+    // Closes c. With retry, unwritten and idempotent requests go back to the
+    // client queue (ahead of newer ones); the rest complete with ec.
+    void drop(const ConnPtr& c, boost::beast::error_code ec, bool retry) {
+        if (c->dead) return;
+        c->dead = true;
+        boost::beast::error_code ignored;
+        c->stream.socket().shutdown(tcp::socket::shutdown_both, ignored);
+        c->stream.close();
+
+        std::vector<Pending> again;
+        auto settle = [&](Pending& p, bool written) {
+            if (retry && (!written || idempotent(*p.req)) && p.attempts < opt_.retries) {
+                ++p.attempts;
+                again.push_back(std::move(p));
+            } else {
+                p.handler(ec ? ec : boost::asio::error::operation_aborted, {});
+            }
+        };
+        for (auto& p : c->awaiting) settle(p, true);
+        for (auto& p : c->to_write) settle(p, false);
+        c->awaiting.clear();
+        c->to_write.clear();
+        for (auto it = again.rbegin(); it != again.rend(); ++it) waiting_.push_front(std::move(*it));
+    }
+};
+
+} // namespace client
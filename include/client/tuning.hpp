@@ -0,0 +1,20 @@
+#pragma once
+#include <boost/asio/ip/tcp.hpp>
+
+namespace client {
+
+// Socket options applied to every client connection once it is established.
+struct SocketTuning {
+    bool no_delay{true};  // small JSON frames must not wait for Nagle
+    int  send_buffer{0};  // SO_SNDBUF in bytes, 0 = kernel default
+    int  recv_buffer{0};  // SO_RCVBUF in bytes, 0 = kernel default
+};
+
+inline void apply(boost::asio::ip::tcp::socket& s, const SocketTuning& t) {
+    boost::system::error_code ec;  // best effort: a refused option is not fatal
+    s.set_option(boost::asio::ip::tcp::no_delay(t.no_delay), ec);
+    if (t.send_buffer > 0) s.set_option(boost::asio::socket_base::send_buffer_size(t.send_buffer), ec);
+    if (t.recv_buffer > 0) s.set_option(boost::asio::socket_base::receive_buffer_size(t.recv_buffer), ec);
+}
+
+} // namespace client
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+
+namespace client {
+
+// http://host:port/path or ws://host:port/path; port and path are optional.
+struct Url {
+    std::string scheme{"http"};
+    std::string host;
+    std::string port;
+    std::string target{"/"};
+
+    // Host header value; many servers expect host:port
+    std::string authority() const { return host + ":" + port; }
+};
+
+inline Url parse_url(const std::string& s) {
+    Url u;
+    std::string rest = s;
+    auto sp = s.find("://");
+    if (sp != std::string::npos) {
+        u.scheme = s.substr(0, sp);
+        rest = s.substr(sp + 3);
+    }
+    auto slash = rest.find('/');
+    std::string hp = slash == std::string::npos ? rest : rest.substr(0, slash);
+    u.target = slash == std::string::npos ? "/" : rest.substr(slash);
+    auto colon = hp.rfind(':');
+    if (colon == std::string::npos) {
+        u.host = hp;
+        u.port = (u.scheme == "https" || u.scheme == "wss") ? "443" : "80";
+    } else {
+        u.host = hp.substr(0, colon);
+        u.port = hp.substr(colon + 1);
+    }
+    if (u.host.empty()) throw std::invalid_argument("url without host: " + s);
+    return u;
+}
+
+} // namespace client
@@ -0,0 +1,278 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "client/url.hpp"
+#include "client/tuning.hpp"
+
+// Asynchronous WebSocket client that stays connected.
+//
+// send() is thread-safe and never blocks: frames are queued and written by a
+// single write loop. Frames queued while disconnected are kept (up to
+// max_queue, oldest dropped first) and sent after the next connect; a frame
+// whose write failed is sent again, so delivery is at-least-once. With
+// batch_max > 1, frames that queued up behind a write go out as one JSON
+// array message (the marshal accepts such batches).
+//
+// After every (re)connect the hello callback's frames are sent first, one
+// message each — the place for subscribe requests that resume from a cursor.
+// Reconnects back off exponentially with jitter. Callbacks run on the
+// client's strand.
+
+namespace client {
+
+struct WsOptions {
+    std::chrono::milliseconds backoff_initial{100};
+    std::chrono::milliseconds backoff_max{5000};
+    std::chrono::milliseconds connect_timeout{5000};
+    size_t max_queue{100000};     // frames held while disconnected
+    size_t batch_max{1};          // frames per message, 1 = no batching
+    size_t batch_bytes{1 << 20};  // size cap of a batched message
+    bool reconnect{true};
+    SocketTuning tuning{};
+};
+
+class WsClient : public std::enable_shared_from_this<WsClient> {
+    using tcp = boost::asio::ip::tcp;
+    using stream_t = boost::beast::websocket::stream<boost::beast::tcp_stream>;
+    using strand_t = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    strand_t strand_;
+    Url url_;
+    WsOptions opt_;
+    tcp::resolver resolver_;
+    boost::asio::steady_timer timer_;
+    std::unique_ptr<stream_t> ws_;
+    boost::beast::flat_buffer buffer_;
+    uint64_t gen_{0};  // bumped per connection; stale completions are ignored
+
+    std::deque<std::string> hello_q_;  // sent first, unbatched
+    std::deque<std::string> queue_;
+    std::vector<std::string> inflight_;
+    bool connected_{false};
+    bool writing_{false};
+    bool closing_{false};
+    bool stopped_{false};
+    bool backing_off_{false};
+    std::chrono::milliseconds backoff_;
+    std::minstd_rand rng_{std::random_device{}()};
+
+    std::function<std::vector<std::string>()> hello_;
+    std::function<void(std::string)> on_message_;
+    std::function<void(bool, boost::beast::error_code)> on_status_;
+
+    std::atomic<bool> up_{false};
+    std::atomic<uint64_t> sent_{0}, dropped_{0}, connects_{0};
+    std::atomic<size_t> queued_{0};
+
+    WsClient(boost::asio::io_context& ioc, Url url, WsOptions opt)
+        : strand_(boost::asio::make_strand(ioc)), url_(std::move(url)), opt_(opt), resolver_(strand_),
+          timer_(strand_), backoff_(opt.backoff_initial) {
+        opt_.batch_max = std::max<size_t>(opt_.batch_max, 1);
+    }
+
+public:
+    static std::shared_ptr<WsClient> create(boost::asio::io_context& ioc, Url url, WsOptions opt = {}) {
+        return std::shared_ptr<WsClient>(new WsClient(ioc, std::move(url), opt));
+    }
+
+    // Set these before start().
+    void on_connect(std::function<std::vector<std::string>()> hello) { hello_ = std::move(hello); }
+    void on_message(std::function<void(std::string)> fn) { on_message_ = std::move(fn); }
+    void on_status(std::function<void(bool up, boost::beast::error_code)> fn) { on_status_ = std::move(fn); }
+
+    void start() {
+        boost::asio::post(strand_, [self = shared_from_this()] { self->connect(); });
+    }
+
+    void send(std::string text) {
+        boost::asio::post(strand_, [self = shared_from_this(), t = std::move(text)]() mutable {
+            if (self->stopped_ || self->closing_) return;
+            if (self->queue_.size() >= self->opt_.max_queue) {
+                self->queue_.pop_front();
+                ++self->dropped_;
+            }
+            self->queue_.push_back(std::move(t));
+            self->queued_ = self->queue_.size();
+            self->do_write();
+        });
+    }
+
+    // Flushes the queue and closes; no reconnects afterwards. A connect in
+    // progress is awaited; a client that is backing off after a failure stops
+    // right away and its queued frames count as dropped.
+    void close() {
+        boost::asio::post(strand_, [self = shared_from_this()] {
+            self->closing_ = true;
+            if (self->connected_) return self->do_write();
+            if (self->backing_off_) {
+                self->timer_.cancel();
+                self->stop();
+            }
+        });
+    }
+
+    bool connected() const { return up_; }
+    uint64_t sent() const { return sent_; }
+    uint64_t dropped() const { return dropped_; }
+    uint64_t connects() const { return connects_; }
+    size_t queued() const { return queued_; }
+
+private:
+    void connect() {
+        if (stopped_) return;
+        const uint64_t g = ++gen_;
+        ws_ = std::make_unique<stream_t>(strand_);
+        auto self = shared_from_this();
+        resolver_.async_resolve(url_.host, url_.port, [self, g](boost::beast::error_code ec, tcp::resolver::results_type r) {
+            if (g != self->gen_) return;
+            if (ec) return self->on_error(g, ec);
+            auto& tcp_layer = self->ws_->next_layer();
+            tcp_layer.expires_after(self->opt_.connect_timeout);
+            tcp_layer.async_connect(r, [self, g](boost::beast::error_code ec, tcp::endpoint) {
+                if (g != self->gen_) return;
+                if (ec) return self->on_error(g, ec);
+                apply(self->ws_->next_layer().socket(), self->opt_.tuning);
+                self->handshake(g);
+            });
+        });
+    }
+
+    void handshake(uint64_t g) {
+        namespace websocket = boost::beast::websocket;
+        ws_->next_layer().expires_never();  // the websocket timeouts take over (incl. keep-alive pings)
+        ws_->set_option(websocket::stream_base::timeout::suggested(boost::beast::role_type::client));
+        ws_->set_option(websocket::stream_base::decorator([](websocket::request_type& req) {
+            req.set(boost::beast::http::field::user_agent, "marshal-client");
+        }));
+        ws_->text(true);
+        ws_->async_handshake(url_.authority(), url_.target, [self = shared_from_this(), g](boost::beast::error_code ec) {
+            if (g != self->gen_) return;
+            if (ec) return self->on_error(g, ec);
+            self->connected_ = true;
+            self->up_ = true;
+            ++self->connects_;
+            self->backoff_ = self->opt_.backoff_initial;
+            self->hello_q_.clear();
+            if (self->hello_)
+                for (auto& h : self->hello_()) self->hello_q_.push_back(std::move(h));
+            if (self->on_status_) self->on_status_(true, {});
+            self->do_read(g);
+            self->do_write();
+        });
+    }
+
+    void do_read(uint64_t g) {
+        ws_->async_read(buffer_, [self = shared_from_this(), g](boost::beast::error_code ec, size_t) {
+            if (g != self->gen_) return;
+            if (ec) return self->on_error(g, ec);
+            std::string msg = boost::beast::buffers_to_string(self->buffer_.data());
+            self->buffer_.consume(self->buffer_.size());
+            if (self->on_message_) self->on_message_(std::move(msg));
+            if (g == self->gen_ && self->connected_) self->do_read(g);
+        });
+    }
+
+    void do_write() {
+        if (!connected_ || writing_) return;
+        auto text = std::make_shared<std::string>();
+        if (!hello_q_.empty()) {
+            *text = std::move(hello_q_.front());
+            hello_q_.pop_front();
+        } else if (!queue_.empty()) {
+            const size_t n = std::min(queue_.size(), opt_.batch_max);
+            if (n == 1) {
+                inflight_.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+                *text = inflight_.back();
+            } else {
+                *text += '[';
+                while (!queue_.empty() && inflight_.size() < n &&
+                       (inflight_.empty() || text->size() + queue_.front().size() < opt_.batch_bytes)) {
+                    if (!inflight_.empty()) *text += ',';
+                    *text += queue_.front();
+                    inflight_.push_back(std::move(queue_.front()));
+                    queue_.pop_front();
+                }
+                *text += ']';
+            }
+            queued_ = queue_.size();
+        } else {
+            if (closing_ && !stopped_) {
+                stopped_ = true;
+                ws_->async_close(boost::beast::websocket::close_code::normal,
+                                 [self = shared_from_this()](boost::beast::error_code) {
+                                     self->connected_ = false;
+                                     self->up_ = false;
+                                 });
+            }
+            return;
+        }
+
+        writing_ = true;
+        const uint64_t g = gen_;
+        ws_->async_write(boost::asio::buffer(*text), [self = shared_from_this(), text, g](boost::beast::error_code ec, size_t) {
+            if (g != self->gen_) return;
+            self->writing_ = false;
+            if (ec) return self->on_error(g, ec);
+            self->sent_ += self->inflight_.size();
+            self->inflight_.clear();
+            self->do_write();
+        });
+    }
+
+    void on_error(uint64_t g, boost::beast::error_code ec) {
+        if (g != gen_) return;
+        if (stopped_ && ec == boost::beast::websocket::error::closed) {
+            connected_ = false;  // the read saw our close handshake finish
+            up_ = false;
+            return;
+        }
+        ++gen_;  // retire every outstanding completion of this connection
+        const bool was_up = connected_;
+        connected_ = false;
+        up_ = false;
+        writing_ = false;
+        buffer_.consume(buffer_.size());
+        // unacknowledged frames go out again first
+        for (auto it = inflight_.rbegin(); it != inflight_.rend(); ++it) queue_.push_front(std::move(*it));
+        inflight_.clear();
+        queued_ = queue_.size();
+        if (ws_) {
+            boost::beast::error_code ignored;
+            ws_->next_layer().socket().close(ignored);
+        }
+        if (was_up && on_status_) on_status_(false, ec);
+        if (stopped_ || closing_ || !opt_.reconnect) return stop();
+
+        std::uniform_int_distribution<long> jitter(backoff_.count() / 2, backoff_.count());
+        timer_.expires_after(std::chrono::milliseconds(jitter(rng_)));
+        backoff_ = std::min(backoff_ * 2, opt_.backoff_max);
+        backing_off_ = true;
+        timer_.async_wait([self = shared_from_this()](boost::beast::error_code ec) {
+            self->backing_off_ = false;
+            if (!ec) self->connect();
+        });
+    }
+
+    void stop() {
+        stopped_ = true;
+        dropped_ += queue_.size();
+        queue_.clear();
+        queued_ = 0;
+    }
+};
+
+} // namespace client
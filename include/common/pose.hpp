@@ -28,6 +28,28 @@ return json{
 }
 
 
+// Inverse of pose_to_json; false when "p" or "R" is missing or malformed, or
+// when "frame", "source" or "t_ms" has the wrong type. Leaves pose unchanged
+// on failure.
+inline bool pose_from_json(const nlohmann::json& j, Pose& pose){
+if (!j.is_object() || !j.contains("p") || !j["p"].is_array() || j["p"].size() != 3) return false;
+if (j.contains("R") && (!j["R"].is_array() || j["R"].size() != 9)) return false;
+if (j.contains("frame") && !j["frame"].is_string()) return false;
+if (j.contains("source") && !j["source"].is_string()) return false;
+if (j.contains("t_ms") && !j["t_ms"].is_number_integer()) return false;
+Pose out = pose;
+try {
+out.p = j["p"].get<std::array<double,3>>();
+if (j.contains("R")) out.R = j["R"].get<std::array<double,9>>();
+out.frame = j.value("frame", out.frame);
+out.source = j.value("source", out.source);
+if (j.contains("t_ms")) out.t = std::chrono::system_clock::time_point(std::chrono::milliseconds(j["t_ms"].get<int64_t>()));
+} catch (const std::exception&) { return false; }
+pose = std::move(out);
+return true;
+}
+
+
 class PoseStore {
 std::mutex m_;
 Pose latest_{};
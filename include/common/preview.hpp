@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREVIEW_X86 1
+#endif
+
+// Compact per-acquisition signal summaries for live viewing.
+//
+// Input is one acquisition's complex-float samples, channel-major as ISMRMRD
+// stores them: iq[2 * (c * samples + s)] = re, [.. + 1] = im. Per coil we
+// compute RMS and peak magnitude, the number of samples with a component at
+// or beyond the saturation threshold, and a magnitude profile decimated to a
+// fixed number of points. The inner loop has AVX-512 and AVX2 versions
+// selected at runtime, with a scalar fallback.
+
+namespace preview {
+
+struct CoilStats {
+    double   sum2{0};    // sum of |x|^2
+    float    peak2{0};   // max |x|^2
+    uint32_t saturated{0};
+};
+
+// Fills mag[0..n) with |x| and returns the per-coil statistics.
+using Kernel = CoilStats (*)(const float* iq, size_t n, float sat, float* mag);
+
+inline CoilStats coil_scalar(const float* iq, size_t n, float sat, float* mag) {
+    CoilStats st;
+    for (size_t i = 0; i < n; ++i) {
+        const float re = iq[2 * i], im = iq[2 * i + 1];
+        const float m2 = re * re + im * im;
+        st.sum2 += m2;
+        st.peak2 = std::max(st.peak2, m2);
+        st.saturated += (std::fabs(re) >= sat) | (std::fabs(im) >= sat);
+        mag[i] = std::sqrt(m2);
+    }
+    return st;
+}
+
+#ifdef PREVIEW_X86
+__attribute__((target("avx2,fma")))
+inline CoilStats coil_avx2(const float* iq, size_t n, float sat, float* mag) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 thr  = _mm256_set1_ps(sat);
+    __m256 acc = _mm256_setzero_ps(), peak = _mm256_setzero_ps();
+    uint32_t saturated = 0;
+    double sum2 = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 a = _mm256_loadu_ps(iq + 2 * i);      // c0..c3 interleaved
+        const __m256 b = _mm256_loadu_ps(iq + 2 * i + 8);  // c4..c7
+        // re^2+im^2 for 8 samples; hadd leaves them in order c0 c1 c4 c5 | c2 c3 c6 c7
+        __m256 m2 = _mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+        m2 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(m2), 0xD8));
+        acc  = _mm256_add_ps(acc, m2);
+        peak = _mm256_max_ps(peak, m2);
+        _mm256_storeu_ps(mag + i, _mm256_sqrt_ps(m2));
+        const unsigned ma = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, a), thr, _CMP_GE_OQ)));
+        const unsigned mb = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, b), thr, _CMP_GE_OQ)));
+        const unsigned m  = ma | (mb << 8);  // bit 2k = re of sample k, 2k+1 = im
+        saturated += static_cast<uint32_t>(__builtin_popcount((m | (m >> 1)) & 0x5555u));
+        if ((i & 1023) == 1016) {  // flush the float accumulator into double now and then
+            alignas(32) float t[8];
+            _mm256_store_ps(t, acc);
+            for (float v : t) sum2 += v;
+            acc = _mm256_setzero_ps();
+        }
+    }
+    alignas(32) float t[8], p[8];
+    _mm256_store_ps(t, acc);
+    _mm256_store_ps(p, peak);
+    CoilStats st;
+    st.sum2 = sum2;
+    for (int k = 0; k < 8; ++k) {
+        st.sum2 += t[k];
+        st.peak2 = std::max(st.peak2, p[k]);
+    }
+    st.saturated = saturated;
+    if (i < n) {
+        auto tail = coil_scalar(iq + 2 * i, n - i, sat, mag + i);
+        st.sum2 += tail.sum2;
+        st.peak2 = std::max(st.peak2, tail.peak2);
+        st.saturated += tail.saturated;
+    }
+    return st;
+}
+
+// GCC 12's avx512fintrin.h trips -Wmaybe-uninitialized on _mm512_undefined_ps
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+__attribute__((target("avx512f")))
+inline CoilStats coil_avx512(const float* iq, size_t n, float sat, float* mag) {
+    const __m512i even = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd  = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+    const __m512i nosign = _mm512_set1_epi32(0x7fffffff);
+    const __m512 thr   = _mm512_set1_ps(sat);
+    __m512 acc = _mm512_setzero_ps(), peak = _mm512_setzero_ps();
+    uint32_t saturated = 0;
+    double sum2 = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 a  = _mm512_loadu_ps(iq + 2 * i);
+        const __m512 b  = _mm512_loadu_ps(iq + 2 * i + 16);
+        const __m512 re = _mm512_permutex2var_ps(a, even, b);  // deinterleave 16 samples
+        const __m512 im = _mm512_permutex2var_ps(a, odd, b);
+        const __m512 m2 = _mm512_fmadd_ps(re, re, _mm512_mul_ps(im, im));
+        acc  = _mm512_add_ps(acc, m2);
+        peak = _mm512_max_ps(peak, m2);
+        _mm512_storeu_ps(mag + i, _mm512_sqrt_ps(m2));
+        const __m512 are  = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(re), nosign));
+        const __m512 aim  = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(im), nosign));
+        const __mmask16 s = _mm512_cmp_ps_mask(are, thr, _CMP_GE_OQ) | _mm512_cmp_ps_mask(aim, thr, _CMP_GE_OQ);
+        saturated += static_cast<uint32_t>(__builtin_popcount(s));
+        if ((i & 2047) == 2032) {  // flush the float accumulator into double now and then
+            alignas(64) float t[16];
+            _mm512_store_ps(t, acc);
+            for (float v : t) sum2 += v;
+            acc = _mm512_setzero_ps();
+        }
+    }
+    alignas(64) float t[16], p[16];
+    _mm512_store_ps(t, acc);
+    _mm512_store_ps(p, peak);
+    CoilStats st;
+    st.sum2 = sum2;
+    for (int k = 0; k < 16; ++k) {
+        st.sum2 += t[k];
+        st.peak2 = std::max(st.peak2, p[k]);
+    }
+    st.saturated = saturated;
+    if (i < n) {
+        auto tail = coil_scalar(iq + 2 * i, n - i, sat, mag + i);
+        st.sum2 += tail.sum2;
+        st.peak2 = std::max(st.peak2, tail.peak2);
+        st.saturated += tail.saturated;
+    }
+    return st;
+}
+#pragma GCC diagnostic pop
+#endif
+
+struct Dispatch {
+    Kernel kernel;
+    const char* isa;
+};
+
+// Every kernel this CPU can run, best first; scalar is always last.
+inline std::vector<Dispatch> supported() {
+    std::vector<Dispatch> out;
+#ifdef PREVIEW_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) out.push_back({coil_avx512, "avx512"});
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) out.push_back({coil_avx2, "avx2"});
+#endif
+    out.push_back({coil_scalar, "scalar"});
+    return out;
+}
+
+// Best kernel for this CPU, chosen once.
+inline const Dispatch& dispatch() {
+    static const Dispatch d = supported().front();
+    return d;
+}
+
+struct Coil {
+    float rms{0};
+    float peak{0};
+    uint32_t saturated{0};
+    std::vector<uint8_t> profile;  // block-mean magnitude, 255 = this coil's peak; min(points, samples) long
+};
+
+// Summarizes one acquisition of `channels` x `samples` complex floats.
+inline std::vector<Coil> summarize(const float* iq, uint32_t channels, uint32_t samples, float sat,
+                                   uint32_t points, Kernel kernel = dispatch().kernel) {
+    std::vector<Coil> out(channels);
+    if (!samples) return out;
+    thread_local std::vector<float> mag;
+    mag.resize(samples);
+    points = std::clamp<uint32_t>(points, 1, samples);
+    for (uint32_t c = 0; c < channels; ++c) {
+        const auto st = kernel(iq + 2ull * c * samples, samples, sat, mag.data());
+        auto& co = out[c];
+        co.rms = static_cast<float>(std::sqrt(st.sum2 / samples));
+        co.peak = std::sqrt(st.peak2);
+        co.saturated = st.saturated;
+        const float scale = co.peak > 0 ? 255.0f / co.peak : 0.0f;
+        // bucket k spans [k * samples / points, (k + 1) * samples / points):
+        // block sizes differ by at most one and there are exactly `points`
+        co.profile.reserve(points);
+        for (uint32_t k = 0; k < points; ++k) {
+            const auto s = static_cast<uint32_t>(uint64_t{k} * samples / points);
+            const auto e = static_cast<uint32_t>(uint64_t{k + 1} * samples / points);
+            float sum = 0;
+            for (uint32_t i = s; i < e; ++i) sum += mag[i];
+            co.profile.push_back(static_cast<uint8_t>(std::lround(std::min(255.0f, sum / (e - s) * scale))));
+        }
+    }
+    return out;
+}
+
+} // namespace preview
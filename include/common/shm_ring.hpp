@@ -0,0 +1,369 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Shared-memory transport for co-located services (marshal, playback, dumpbox).
+//
+// A region /dev/shm/<name> holds a header and a power-of-two array of
+// fixed-size slots, each carrying one frame (the same JSON text that travels
+// over the WebSocket). Two layouts share the format:
+//   ShmQueue      bounded lock-free MPMC queue (Vyukov); producers -> marshal
+//   ShmBroadcast  single-writer ring read by any number of ShmSubscribers,
+//                 each with its own cursor; slow readers are lapped, never
+//                 block the writer
+// Waiting sides sleep on a futex word in the header, so an idle reader costs
+// nothing and a publish wakes it within microseconds.
+//
+// An owner that restarts unlinks its region and creates a new one under the
+// same name; peers still map the old one. stale() tells them to attach again.
+// The owner may name the numbering of the frames it carries (the marshal log
+// epoch) in the header, so a peer that attaches can tell whether sequence
+// numbers it saw before still apply.
+
+namespace shm {
+
+inline constexpr uint64_t kMagic   = 0x4d52445348524e47ull; // "MRDSHRNG"
+inline constexpr uint32_t kVersion = 2;
+
+struct alignas(64) Header {
+    std::atomic<uint64_t> magic;       // written last by the creator
+    uint32_t version;
+    uint32_t slot_bytes;               // payload capacity of one slot
+    uint64_t slots;                    // power of two
+    char epoch[24];                    // NUL-terminated, empty when the owner names none
+    alignas(64) std::atomic<uint64_t> head;    // next position to write
+    alignas(64) std::atomic<uint64_t> tail;    // next position to read (queue only)
+    alignas(64) std::atomic<uint32_t> wake;    // futex word, bumped on every publish
+    std::atomic<uint32_t> waiters;
+    std::atomic<uint32_t> space_wake;  // futex word, bumped when a queue slot frees up
+    std::atomic<uint32_t> space_waiters;
+};
+
+struct Slot {
+    std::atomic<uint64_t> seq;
+    uint32_t len;
+    uint32_t pad;
+    char data[1];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free);
+
+inline void futex_wait(std::atomic<uint32_t>& w, uint32_t expected, std::chrono::microseconds timeout) {
+    timespec ts{static_cast<time_t>(timeout.count() / 1000000), static_cast<long>(timeout.count() % 1000000) * 1000};
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&w), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline void futex_wake_all(std::atomic<uint32_t>& w) {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&w), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline size_t slot_stride(uint32_t slot_bytes) {
+    return (offsetof(Slot, data) + slot_bytes + 63) & ~size_t(63);
+}
+
+// RAII mapping of /dev/shm/<name>; create() (re)initializes, attach() maps an existing region.
+class Region {
+    std::string name_;
+    void*  base_{nullptr};
+    size_t size_{0};
+    bool   owner_{false};
+    ino_t  ino_{0};
+
+    Region(std::string name, void* base, size_t size, bool owner, ino_t ino)
+        : name_(std::move(name)), base_(base), size_(size), owner_(owner), ino_(ino) {}
+
+public:
+    Region() = default;
+    Region(Region&& o) noexcept { *this = std::move(o); }
+    Region& operator=(Region&& o) noexcept {
+        std::swap(name_, o.name_); std::swap(base_, o.base_);
+        std::swap(size_, o.size_); std::swap(owner_, o.owner_);
+        std::swap(ino_, o.ino_);
+        return *this;
+    }
+    ~Region() {
+        if (base_) ::munmap(base_, size_);
+        if (owner_ && !stale()) ::shm_unlink(name_.c_str());  // never a successor's region
+    }
+
+    static Region create(const std::string& name, uint64_t slots, uint32_t slot_bytes, std::string_view epoch = {}) {
+        if (slots == 0 || (slots & (slots - 1))) throw std::invalid_argument("shm slots must be a power of two");
+        const std::string n = "/" + name;
+        ::shm_unlink(n.c_str());
+        int fd = ::shm_open(n.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+        if (fd < 0) throw std::runtime_error("shm_open failed: " + name);
+        const size_t size = sizeof(Header) + slots * slot_stride(slot_bytes);
+        struct stat st{};
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0 || ::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("shm ftruncate failed: " + name);
+        }
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("shm mmap failed: " + name);
+
+        auto* h = new (p) Header{};
+        h->version = kVersion;
+        h->slot_bytes = slot_bytes;
+        h->slots = slots;
+        epoch.copy(h->epoch, std::min(epoch.size(), sizeof(h->epoch) - 1));
+        for (uint64_t i = 0; i < slots; ++i) {
+            auto* s = reinterpret_cast<Slot*>(static_cast<char*>(p) + sizeof(Header) + i * slot_stride(slot_bytes));
+            new (&s->seq) std::atomic<uint64_t>(i);
+            s->len = 0;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic.store(kMagic, std::memory_order_release);
+        return Region(n, p, size, true, st.st_ino);
+    }
+
+    // nullopt while the owner has not created the region yet
+    static std::optional<Region> attach(const std::string& name) {
+        const std::string n = "/" + name;
+        int fd = ::shm_open(n.c_str(), O_RDWR, 0);
+        if (fd < 0) return std::nullopt;
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return std::nullopt;
+        auto* h = static_cast<Header*>(p);
+        if (h->magic.load(std::memory_order_acquire) != kMagic ||
+            h->version != kVersion) {
+            ::munmap(p, static_cast<size_t>(st.st_size));
+            return std::nullopt;
+        }
+        return Region(n, p, static_cast<size_t>(st.st_size), false, st.st_ino);
+    }
+
+    // attach(), retrying until the owner appears
+    static Region attach_wait(const std::string& name, std::chrono::milliseconds poll = std::chrono::milliseconds(200)) {
+        for (;;) {
+            if (auto r = attach(name)) return std::move(*r);
+            std::this_thread::sleep_for(poll);
+        }
+    }
+
+    // true once the name no longer refers to this region (owner gone or restarted)
+    bool stale() const {
+        int fd = ::shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd < 0) return true;
+        struct stat st{};
+        const bool same = ::fstat(fd, &st) == 0 && st.st_ino == ino_;
+        ::close(fd);
+        return !same;
+    }
+
+    std::string epoch() const {
+        auto* h = header();
+        return std::string(h->epoch, ::strnlen(h->epoch, sizeof(h->epoch)));
+    }
+
+    Header* header() const { return static_cast<Header*>(base_); }
+    Slot* slot(uint64_t pos) const {
+        auto* h = header();
+        return reinterpret_cast<Slot*>(static_cast<char*>(base_) + sizeof(Header) +
+                                       (pos & (h->slots - 1)) * slot_stride(h->slot_bytes));
+    }
+};
+
+// Bounded MPMC queue: many local producers, the marshal consumes.
+class ShmQueue {
+    Region r_;
+
+public:
+    explicit ShmQueue(Region r) : r_(std::move(r)) {}
+
+    uint32_t slot_bytes() const { return r_.header()->slot_bytes; }
+    bool stale() const { return r_.stale(); }
+
+    // false when the frame is too large or the queue is full
+    bool try_push(const void* data, size_t n) {
+        auto* h = r_.header();
+        if (n > h->slot_bytes) return false;
+        uint64_t pos = h->head.load(std::memory_order_relaxed);
+        Slot* s;
+        for (;;) {
+            s = r_.slot(pos);
+            const uint64_t seq = s->seq.load(std::memory_order_acquire);
+            const int64_t dif  = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (dif == 0) {
+                if (h->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = h->head.load(std::memory_order_relaxed);
+            }
+        }
+        std::memcpy(s->data, data, n);
+        s->len = static_cast<uint32_t>(n);
+        s->seq.store(pos + 1, std::memory_order_release);
+        h->wake.fetch_add(1, std::memory_order_release);
+        if (h->waiters.load(std::memory_order_acquire)) futex_wake_all(h->wake);
+        return true;
+    }
+
+    // Blocks while the queue is full, for up to `timeout`. False for oversized
+    // frames, on timeout, and once the region turned stale (checked about
+    // once a second while waiting), so a dead consumer cannot hang the caller.
+    bool push(const std::string& frame, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+        auto* h = r_.header();
+        if (frame.size() > h->slot_bytes) return false;
+        constexpr auto kWait = std::chrono::milliseconds(10);
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (unsigned waits = 0;; ++waits) {
+            const uint32_t w = h->space_wake.load(std::memory_order_acquire);
+            if (try_push(frame.data(), frame.size())) return true;
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            if (waits % 100 == 99 && stale()) return false;
+            h->space_waiters.fetch_add(1, std::memory_order_acq_rel);
+            futex_wait(h->space_wake, w, kWait);
+            h->space_waiters.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    bool try_pop(std::string& out) {
+        auto* h = r_.header();
+        uint64_t pos = h->tail.load(std::memory_order_relaxed);
+        Slot* s;
+        for (;;) {
+            s = r_.slot(pos);
+            const uint64_t seq = s->seq.load(std::memory_order_acquire);
+            const int64_t dif  = static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1);
+            if (dif == 0) {
+                if (h->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = h->tail.load(std::memory_order_relaxed);
+            }
+        }
+        out.assign(s->data, s->len);
+        s->seq.store(pos + h->slots, std::memory_order_release);
+        h->space_wake.fetch_add(1, std::memory_order_release);
+        if (h->space_waiters.load(std::memory_order_acquire)) futex_wake_all(h->space_wake);
+        return true;
+    }
+
+    // waits up to `timeout` for a frame
+    bool pop(std::string& out, std::chrono::microseconds timeout) {
+        auto* h = r_.header();
+        const uint32_t w = h->wake.load(std::memory_order_acquire);
+        if (try_pop(out)) return true;
+        h->waiters.fetch_add(1, std::memory_order_acq_rel);
+        futex_wait(h->wake, w, timeout);
+        h->waiters.fetch_sub(1, std::memory_order_acq_rel);
+        return try_pop(out);
+    }
+};
+
+// Single-writer broadcast ring (marshal -> local subscribers).
+class ShmBroadcast {
+    Region r_;
+
+public:
+    explicit ShmBroadcast(Region r) : r_(std::move(r)) {}
+
+    uint32_t slot_bytes() const { return r_.header()->slot_bytes; }
+
+    // Only one thread may publish. Oversized frames are skipped (returns false).
+    bool publish(const void* data, size_t n) {
+        auto* h = r_.header();
+        if (n > h->slot_bytes) return false;
+        const uint64_t pos = h->head.load(std::memory_order_relaxed);
+        Slot* s = r_.slot(pos);
+        s->seq.store(0, std::memory_order_relaxed);  // mark busy for seqlock readers
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(s->data, data, n);
+        s->len = static_cast<uint32_t>(n);
+        s->seq.store(pos + 1, std::memory_order_release);
+        h->head.store(pos + 1, std::memory_order_release);
+        h->wake.fetch_add(1, std::memory_order_release);
+        if (h->waiters.load(std::memory_order_acquire)) futex_wake_all(h->wake);
+        return true;
+    }
+    bool publish(const std::string& frame) { return publish(frame.data(), frame.size()); }
+};
+
+// Reader of a ShmBroadcast ring with a private cursor.
+class ShmSubscriber {
+    Region   r_;
+    uint64_t cursor_;
+    uint64_t lost_{0};
+
+public:
+    // from_oldest: start with the frames still in the ring instead of only new ones
+    explicit ShmSubscriber(Region r, bool from_oldest = false) : r_(std::move(r)) {
+        auto* h = r_.header();
+        const uint64_t head = h->head.load(std::memory_order_acquire);
+        cursor_ = (from_oldest && head > h->slots) ? head - h->slots : (from_oldest ? 0 : head);
+    }
+
+    // frames overwritten before this reader got to them
+    uint64_t lost() const { return lost_; }
+    bool stale() const { return r_.stale(); }
+    std::string epoch() const { return r_.epoch(); }
+
+    bool try_next(std::string& out) {
+        auto* h = r_.header();
+        for (;;) {
+            const uint64_t head = h->head.load(std::memory_order_acquire);
+            if (cursor_ >= head) return false;
+            if (head - cursor_ > h->slots) {  // lapped: skip to the oldest intact slot
+                lost_ += head - h->slots - cursor_;
+                cursor_ = head - h->slots;
+            }
+            Slot* s = r_.slot(cursor_);
+            const uint64_t s1 = s->seq.load(std::memory_order_acquire);
+            if (s1 == cursor_ + 1) {
+                const uint32_t len = std::min<uint32_t>(s->len, h->slot_bytes);
+                out.assign(s->data, len);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s->seq.load(std::memory_order_relaxed) == s1) {
+                    ++cursor_;
+                    return true;
+                }
+            }
+            // overwritten (or being overwritten) under us: re-evaluate against the new head
+            if (s1 == 0 || s1 > cursor_ + 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            return false;
+        }
+    }
+
+    bool next(std::string& out, std::chrono::microseconds timeout) {
+        auto* h = r_.header();
+        const uint32_t w = h->wake.load(std::memory_order_acquire);
+        if (try_next(out)) return true;
+        h->waiters.fetch_add(1, std::memory_order_acq_rel);
+        futex_wait(h->wake, w, timeout);
+        h->waiters.fetch_sub(1, std::memory_order_acq_rel);
+        return try_next(out);
+    }
+};
+
+} // namespace shm
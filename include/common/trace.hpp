@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Per-message latency tracing across playback -> marshal -> dumpbox.
+//
+// A sampled frame carries {"trace": {"id": N, "send": ns, ...}}; every hop adds
+// its CLOCK_MONOTONIC timestamp (comparable between processes on one host):
+//   send       producer wrote the frame
+//   m_rx       marshal received it
+//   m_enq      marshal handed it to fan-out
+//   c_rx       consumer received it
+//   c_persist  consumer finished persisting it
+// Consumers send the completed context back as {"op":"trace","trace":{...}}
+// and the marshal folds it into per-hop histograms.
+
+namespace trace {
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Stamps `key` on a traced frame; untraced frames are left alone.
+inline void stamp(nlohmann::json& frame, const char* key, int64_t ns = now_ns()) {
+    auto it = frame.find("trace");
+    if (it != frame.end() && it->is_object()) (*it)[key] = ns;
+}
+
+// Stamp `key` of trace context `t`; nullopt when absent or not an integer.
+inline std::optional<int64_t> at(const nlohmann::json& t, const char* key) {
+    auto it = t.find(key);
+    if (it == t.end() || !it->is_number_integer()) return std::nullopt;
+    return it->get<int64_t>();
+}
+
+// True for a context this code can read: an object whose stamps are integers.
+// Frames from other peers may carry anything under "trace".
+inline bool valid(const nlohmann::json& t) {
+    if (!t.is_object()) return false;
+    for (const char* k : {"send", "m_rx", "m_enq", "c_rx", "c_persist"})
+        if (t.contains(k) && !at(t, k)) return false;
+    return true;
+}
+
+// Picks 1 of every `every` frames (0 = never).
+class Sampler {
+    uint64_t every_;
+    uint64_t n_{0};
+    uint64_t id_;
+
+public:
+    explicit Sampler(uint64_t every, uint64_t id_base = 0) : every_(every), id_(id_base) {}
+    // attaches a fresh trace context to `frame` when sampled
+    bool maybe_attach(nlohmann::json& frame) {
+        if (!every_ || n_++ % every_) return false;
+        frame["trace"] = {{"id", ++id_}, {"send", now_ns()}};
+        return true;
+    }
+};
+
+// Lock-free log-linear histogram of nanosecond durations: 4 sub-buckets per
+// power of two, so percentiles are within ~12% of the true value.
+class Histogram {
+    static constexpr int kBuckets = 64 * 4;
+    std::array<std::atomic<uint64_t>, kBuckets> b_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+
+    static int bucket(uint64_t v) {
+        if (v < 4) return static_cast<int>(v);
+        const int msb = 63 - __builtin_clzll(v);
+        return msb * 4 + static_cast<int>((v >> (msb - 2)) & 3);
+    }
+    static uint64_t upper(int b) {
+        if (b < 4) return static_cast<uint64_t>(b);
+        const int msb = b / 4, sub = b % 4;
+        return (static_cast<uint64_t>(4 + sub + 1) << (msb - 2)) - 1;
+    }
+
+public:
+    void record(int64_t ns) {
+        const uint64_t v = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+        b_[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = max_.load(std::memory_order_relaxed);
+        while (v > m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+    uint64_t percentile(double p) const {
+        const uint64_t n = count();
+        if (!n) return 0;
+        const uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(n - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += b_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(upper(i), max_.load(std::memory_order_relaxed));
+        }
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    nlohmann::json summary() const {
+        const uint64_t n = count();
+        auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+        return {{"count", n},
+                {"mean_us", n ? us(sum_.load(std::memory_order_relaxed) / n) : 0.0},
+                {"p50_us", us(percentile(0.50))},
+                {"p90_us", us(percentile(0.90))},
+                {"p99_us", us(percentile(0.99))},
+                {"max_us", us(max_.load(std::memory_order_relaxed))}};
+    }
+};
+
+enum Hop { SendToRx, RxToFanout, FanoutToWrite, FanoutToConsumer, ConsumerPersist, EndToEnd, kHops };
+
+inline const char* hop_name(int h) {
+    static const char* names[kHops] = {"send_to_marshal_rx", "marshal_rx_to_fanout", "fanout_to_write_done",
+                                       "fanout_to_consumer_rx", "consumer_rx_to_persist", "end_to_end"};
+    return names[h];
+}
+
+struct Stats {
+    std::array<Histogram, kHops> hops;
+
+    nlohmann::json to_json() const {
+        nlohmann::json j = nlohmann::json::object();
+        for (int h = 0; h < kHops; ++h) j[hop_name(h)] = hops[h].summary();
+        return j;
+    }
+};
+
+// Appends completed traces to a Chrome trace file (chrome://tracing, Perfetto)
+// in the JSON array format, one "X" event per hop and one row per hop.
+// write() only queues the trace, so the caller (the marshal's io thread) never
+// waits for the disk; the writer's own thread formats and appends what is
+// queued every kFlushEvery, and once more when the writer is destroyed.
+// Traces beyond kMaxQueued are dropped and counted.
+class ChromeTraceWriter {
+    static constexpr auto kFlushEvery = std::chrono::milliseconds(200);
+    static constexpr size_t kMaxQueued = 1 << 16;
+
+    std::ofstream f_;  // worker thread only once constructed
+    std::mutex m_;
+    std::condition_variable_any cv_;
+    std::vector<nlohmann::json> queue_;
+    std::atomic<uint64_t> dropped_{0};
+
+    std::jthread worker_;  // last: stops before the members it uses go away
+
+public:
+    explicit ChromeTraceWriter(const std::string& path) : f_(path, std::ios::trunc) {
+        if (!f_) throw std::runtime_error("open trace dump failed: " + path);
+        f_ << "[\n";  // the closing bracket is optional in this format
+        worker_ = std::jthread([this](std::stop_token st) { run(st); });
+    }
+
+    void write(const nlohmann::json& t) {
+        std::scoped_lock lk(m_);
+        if (queue_.size() >= kMaxQueued) {
+            ++dropped_;
+            return;
+        }
+        queue_.push_back(t);
+    }
+
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    void run(std::stop_token st) {
+        std::vector<nlohmann::json> batch;
+        for (bool last = false; !last;) {
+            {
+                std::unique_lock lk(m_);
+                cv_.wait_for(lk, st, kFlushEvery, [] { return false; });  // woken early only by stop
+                last = st.stop_requested();
+                batch.swap(queue_);
+            }
+            std::string out;
+            for (auto& t : batch) append_events(out, t);
+            batch.clear();
+            if (!out.empty()) f_ << out << std::flush;
+        }
+    }
+
+    static void append_events(std::string& out, const nlohmann::json& t) {
+        static const std::array<std::pair<const char*, const char*>, 5> spans = {{
+            {"send", "m_rx"}, {"m_rx", "m_enq"}, {"m_enq", "c_rx"}, {"c_rx", "c_persist"}, {"send", "c_persist"}}};
+        static const int rows[] = {SendToRx, RxToFanout, FanoutToConsumer, ConsumerPersist, EndToEnd};
+        for (size_t i = 0; i < spans.size(); ++i) {
+            auto [a, b] = spans[i];
+            const auto ta = at(t, a), tb = at(t, b);
+            if (!ta || !tb) continue;
+            out += nlohmann::json{{"name", hop_name(rows[i])}, {"ph", "X"}, {"pid", 1}, {"tid", rows[i]},
+                                  {"ts", static_cast<double>(*ta) / 1000.0},
+                                  {"dur", static_cast<double>(*tb - *ta) / 1000.0},
+                                  {"args", {{"id", t.contains("id") ? t["id"] : nlohmann::json(0)}}}}.dump();
+            out += ",\n";
+        }
+    }
+};
+
+} // namespace trace
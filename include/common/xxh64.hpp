@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+// XXH64 (xxHash, 64-bit variant): a fast non-cryptographic hash, used to
+// content-address stored blobs. State accepts the input in arbitrary chunks
+// and yields the same digest as the one-shot hash() over the whole input.
+
+namespace xxh64 {
+
+namespace detail {
+constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+inline uint64_t read64(const uint8_t* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }  // little-endian hosts
+inline uint32_t read32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+inline uint64_t round(uint64_t acc, uint64_t in) { return rotl(acc + in * P2, 31) * P1; }
+inline uint64_t merge(uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; }
+} // namespace detail
+
+class State {
+    uint64_t v_[4];
+    uint64_t seed_;
+    uint64_t total_{0};
+    uint8_t  buf_[32];
+    size_t   buffered_{0};
+
+public:
+    explicit State(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0) {
+        using namespace detail;
+        seed_ = seed;
+        v_[0] = seed + P1 + P2;
+        v_[1] = seed + P2;
+        v_[2] = seed;
+        v_[3] = seed - P1;
+        total_ = 0;
+        buffered_ = 0;
+    }
+
+    void update(const void* data, size_t n) {
+        using namespace detail;
+        auto p = static_cast<const uint8_t*>(data);
+        total_ += n;
+        if (buffered_ + n < 32) {
+            if (n) std::memcpy(buf_ + buffered_, p, n);
+            buffered_ += n;
+            return;
+        }
+        if (buffered_) {
+            const size_t k = 32 - buffered_;
+            std::memcpy(buf_ + buffered_, p, k);
+            stripe(buf_);
+            p += k;
+            n -= k;
+            buffered_ = 0;
+        }
+        for (; n >= 32; p += 32, n -= 32) stripe(p);
+        std::memcpy(buf_, p, n);
+        buffered_ = n;
+    }
+
+    uint64_t digest() const {
+        using namespace detail;
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (uint64_t v : v_) h = merge(h, v);
+        } else {
+            h = seed_ + P5;
+        }
+        h += total_;
+        const uint8_t* p = buf_;
+        size_t n = buffered_;
+        for (; n >= 8; p += 8, n -= 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+        if (n >= 4) {
+            h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n; ++p, --n) h = rotl(h ^ (*p * P5), 11) * P1;
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    void stripe(const uint8_t* p) {
+        for (int i = 0; i < 4; ++i) v_[i] = detail::round(v_[i], detail::read64(p + 8 * i));
+    }
+};
+
+inline uint64_t hash(const void* data, size_t n, uint64_t seed = 0) {
+    State s(seed);
+    s.update(data, n);
+    return s.digest();
+}
+
+} // namespace xxh64
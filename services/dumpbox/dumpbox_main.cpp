@@ -3,20 +3,21 @@
 #include <fstream>
 #include <nlohmann/json.hpp>
 #include <boost/asio.hpp>
-#include <boost/beast/core.hpp>
-#include <boost/beast/websocket.hpp>
 #include <ismrmrd/dataset.h>
 #include <ismrmrd/ismrmrd.h>
-#include <boost/beast/core/flat_buffer.hpp>
+#include <memory>
+#include "common/shm_ring.hpp"
+#include "common/trace.hpp"
+#include "client/ws_client.hpp"
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
-namespace websocket = boost::beast::websocket;
 
 int main(int argc, char **argv)
 {
     std::string ws_url = "ws://localhost:8090/ws";
     std::string data = "/data";
+    std::string shm_name; // read the marshal's shared-memory ring instead of WS
     for (int i = 1; i < argc; ++i)
     {
         std::string a = argv[i];
@@ -24,25 +25,17 @@ int main(int argc, char **argv)
             ws_url = argv[++i];
         else if (a == "--data" && i + 1 < argc)
             data = argv[++i];
+        else if (a == "--shm" && i + 1 < argc)
+            shm_name = argv[++i];
     }
 
-    // connect WS
+    // connect WS (reconnecting), or read the local shared-memory ring (attached below)
     boost::asio::io_context ioc;
-    boost::asio::ip::tcp::resolver res{ioc};
-    auto pos = ws_url.find("//");
-    auto hostport = ws_url.substr(pos + 2);
-    auto slash = hostport.find("/");
-    auto host = hostport.substr(0, hostport.find(":"));
-    auto port = hostport.substr(host.size() + 1, slash - host.size() - 1);
-    auto target = hostport.substr(slash);
-    auto const results = res.resolve(host, port);
-    boost::asio::ip::tcp::socket sock{ioc};
-    boost::asio::connect(sock, results.begin(), results.end());
-    websocket::stream<boost::asio::ip::tcp::socket> ws{std::move(sock)};
-    ws.handshake(host, target);
-    //std::string host_hdr = host + ":" + port; // many servers expect host:port
-    //ws.handshake(host_hdr, target);
-    //ws.text(true); // we expect JSON text
+    std::shared_ptr<client::WsClient> ws;
+    std::unique_ptr<shm::ShmSubscriber> shm_sub;
+    std::unique_ptr<shm::ShmQueue> shm_reports; // trace reports go back through <name>.in
+    if (shm_name.empty())
+        ws = client::WsClient::create(ioc, client::parse_url(ws_url));
 
     // prepare MRD path
     auto day = fs::path(data) / "mrd";
@@ -52,17 +45,52 @@ int main(int argc, char **argv)
 
     auto index_path = fs::path(data) / "index.jsonl";
     auto latest_path = fs::path(data) / "latest.json";
+    auto cursor_path = fs::path(data) / "dumpbox.cursor";
+    auto epoch_path = fs::path(data) / "dumpbox.epoch";
 
-    // receive and append loop
-    boost::beast::flat_buffer buffer;
-    while (true)
+    // resume after the last persisted frame; the cursor only applies within
+    // the marshal log epoch it was taken in
+    uint64_t cursor = 0;
+    std::string epoch;
+    {
+        std::ifstream cf(cursor_path);
+        cf >> cursor;
+        std::ifstream ef(epoch_path);
+        ef >> epoch;
+    }
+
+    auto handle = [&](const std::string &s, int64_t rx_ns)
     {
-        ws.read(buffer);
-        auto s = boost::beast::buffers_to_string(buffer.data());
-        buffer.consume(buffer.size());
         auto j = json::parse(s, nullptr, false);
         if (!j.is_object() || !j.contains("topic"))
-            continue;
+            return;
+        // a marshal restarted without --ws-log numbers from 1 again under a new
+        // epoch: start over from its first frame (frames it already replayed
+        // under the old cursor are written again)
+        if (j["topic"] == "ws.subscribed" && ws)
+        {
+            const json &p = j["payload"];
+            const uint64_t head = p.is_object() && p.contains("head_seq") && p["head_seq"].is_number_unsigned() ? p["head_seq"].get<uint64_t>() : cursor;
+            const std::string now = p.is_object() && p.contains("epoch") && p["epoch"].is_string() ? p["epoch"].get<std::string>() : epoch;
+            const bool restarted = (!epoch.empty() && now != epoch) || head < cursor;
+            if (now != epoch)
+            {
+                epoch = now;
+                std::ofstream(epoch_path, std::ios::trunc) << epoch;
+            }
+            if (restarted)
+            {
+                std::cerr << "dumpbox: marshal log restarted (epoch " << epoch << "), resetting cursor\n";
+                cursor = 0;
+                std::ofstream(cursor_path, std::ios::trunc) << cursor;
+                ws->send(json{{"op", "subscribe"}, {"topics", {"mrd.acq"}}, {"from_seq", 1}}.dump());
+            }
+            return;
+        }
+        // the shm ring starts at its oldest frame and WS delivery is at-least-once;
+        // skip what is already persisted
+        if (j.contains("seq") && (!j["seq"].is_number_unsigned() || j["seq"].get<uint64_t>() <= cursor))
+            return;
         if (j["topic"] == "mrd.acq")
         {
             // toy example: write a dummy acquisition with timestamp meta
@@ -78,6 +106,125 @@ int main(int argc, char **argv)
             // latest.json atomic update
             std::ofstream lat(latest_path, std::ios::trunc);
             lat << json{{"file", file.string()}, {"updated_ms", ms}}.dump();
+            if (j.contains("seq"))
+            {
+                cursor = j["seq"].get<uint64_t>();
+                std::ofstream cur(cursor_path, std::ios::trunc);
+                cur << cursor;
+            }
+            // report sampled latency back to the marshal
+            if (j.contains("trace"))
+            {
+                trace::stamp(j, "c_rx", rx_ns);
+                trace::stamp(j, "c_persist");
+                const std::string report = json{{"op", "trace"}, {"trace", j["trace"]}}.dump();
+                if (shm_reports)
+                    shm_reports->try_push(report.data(), report.size());
+                else
+                    ws->send(report);
+            }
+        }
+    };
+
+    if (!shm_name.empty())
+    {
+        // The ring only holds the newest frames. Whatever it no longer has
+        // (frames published while dumpbox was down or between two rings, or
+        // overwritten before dumpbox read them) is replayed from the marshal
+        // log over WS, after the cursor; the ring then continues, and frames
+        // both deliver are skipped by seq. Gives up after a while when the
+        // marshal cannot be reached, leaving the gap logged.
+        auto fill_from_log = [&]
+        {
+            boost::asio::io_context gap_ioc;
+            client::WsOptions opt;
+            opt.reconnect = false;
+            auto gap_ws = client::WsClient::create(gap_ioc, client::parse_url(ws_url), opt);
+            const uint64_t from = cursor + 1;
+            bool done = false;
+            gap_ws->on_connect([from]
+                               { return std::vector<std::string>{json{{"op", "subscribe"}, {"topics", {"mrd.acq"}}, {"from_seq", from}}.dump()}; });
+            gap_ws->on_message([&](std::string s)
+                               {
+                if (done)
+                    return;
+                auto j = json::parse(s, nullptr, false);
+                const std::string topic = j.is_object() && j.contains("topic") && j["topic"].is_string() ? j["topic"].get<std::string>() : "";
+                if (topic == "ws.gap")
+                    std::cerr << "dumpbox: marshal log no longer holds every frame after seq " << from - 1 << "\n";
+                else if (topic == "ws.subscribed")
+                {
+                    done = true; // replayed up to the head at subscribe time
+                    gap_ws->close();
+                }
+                else
+                    handle(s, trace::now_ns()); });
+            gap_ws->start();
+            gap_ioc.run_for(std::chrono::seconds(30));
+            if (!done)
+                std::cerr << "dumpbox: could not replay the marshal log after seq " << from - 1 << " from " << ws_url << "\n";
+        };
+        // a marshal restarted without --ws-log numbers from 1 again under a
+        // new epoch, which its ring carries: start over from its first frame
+        auto attach = [&]
+        {
+            shm_sub = std::make_unique<shm::ShmSubscriber>(shm::Region::attach_wait(shm_name + ".out"), /*from_oldest=*/true);
+            shm_reports = std::make_unique<shm::ShmQueue>(shm::Region::attach_wait(shm_name + ".in"));
+            const std::string now = shm_sub->epoch();
+            if (now != epoch)
+            {
+                if (!epoch.empty())
+                {
+                    std::cerr << "dumpbox: marshal log restarted (epoch " << now << "), resetting cursor\n";
+                    cursor = 0;
+                    std::ofstream(cursor_path, std::ios::trunc) << cursor;
+                }
+                epoch = now;
+                std::ofstream(epoch_path, std::ios::trunc) << epoch;
+            }
+            if (cursor)
+                fill_from_log();
+        };
+
+        attach();
+        std::string s;
+        uint64_t lost = shm_sub->lost();
+        while (true)
+        {
+            if (shm_sub->next(s, std::chrono::seconds(1)))
+            {
+                if (shm_sub->lost() != lost)
+                {
+                    std::cerr << "dumpbox: lapped by the shm ring (" << shm_sub->lost() - lost
+                              << " frames), replaying from the marshal log after seq " << cursor << "\n";
+                    lost = shm_sub->lost();
+                    fill_from_log();
+                }
+                handle(s, trace::now_ns());
+                continue;
+            }
+            // a restarted marshal unlinks the old ring and creates a new one: reattach
+            if (!shm_sub->stale())
+                continue;
+            std::cerr << "dumpbox: marshal shared memory was replaced, reattaching\n";
+            attach();
+            lost = shm_sub->lost();
         }
     }
-}
\ No newline at end of file
+
+    // (re)subscribe after the last persisted frame on every connect; the
+    // marshal replays the gap from its log
+    ws->on_connect([&]
+                   {
+                       json sub{{"op", "subscribe"}, {"topics", {"mrd.acq"}}};
+                       if (cursor)
+                           sub["from_seq"] = cursor + 1;
+                       return std::vector<std::string>{sub.dump()}; });
+    ws->on_status([&](bool up, boost::beast::error_code ec)
+                  { std::cerr << "dumpbox: " << (up ? "connected, resuming after seq " + std::to_string(cursor)
+                                                     : "disconnected: " + ec.message()) << "\n"; });
+    ws->on_message([&](std::string s)
+                   { handle(s, trace::now_ns()); });
+    ws->start();
+    ioc.run();
+}
@@ -3,52 +3,32 @@
 #include <thread>
 #include <stdexcept>
 #include <boost/asio.hpp>
-#include <boost/beast/core.hpp>
-#include <boost/beast/websocket.hpp>
 #include <ismrmrd/dataset.h>
 #include <nlohmann/json.hpp>
 #include <fstream>
+#include <memory>
+#include "common/shm_ring.hpp"
+#include "common/base64.hpp"
+#include "common/trace.hpp"
+#include "client/ws_client.hpp"
+#include <unistd.h>
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
-namespace websocket = boost::beast::websocket;
-
-static void ws_send(websocket::stream<boost::asio::ip::tcp::socket> &ws, const json &j)
-{
-    const std::string s = j.dump();
-    ws.text(true);
-    ws.write(boost::asio::buffer(s));
-}
-
-static void parse_ws_url(const std::string &ws_url,
-                         std::string &host, std::string &port, std::string &target)
-{
-    // expect ws://host:port/path
-    auto scheme_pos = ws_url.find("://");
-    auto rest = (scheme_pos == std::string::npos) ? ws_url : ws_url.substr(scheme_pos + 3);
-    auto slash = rest.find('/');
-    std::string hp = (slash == std::string::npos) ? rest : rest.substr(0, slash);
-    target = (slash == std::string::npos) ? "/" : rest.substr(slash);
-    auto colon = hp.find(':');
-    if (colon == std::string::npos)
-    {
-        host = hp;
-        port = "80"; // default
-    }
-    else
-    {
-        host = hp.substr(0, colon);
-        port = hp.substr(colon + 1);
-    }
-}
 
 int main(int argc, char **argv)
 {
+    boost::asio::io_context ioc; // drives the WS client on `io`
+    std::thread io;
     try
     {
         std::string http = "http://localhost:8080"; // reserved for future
         std::string ws_url = "ws://localhost:8090/ws";
         std::string data = "/data"; // NOTE: if your metadata lives under /data/mrd, pass --data /data/mrd
+        std::string shm_name;       // publish through the marshal's shared-memory queue instead of WS
+        uint64_t trace_every = 100; // attach a latency trace context to 1 of every N frames (0 = off)
+        size_t batch = 32;          // frames per WS message when the connection falls behind
+        bool samples = false;       // also send each acquisition's k-space on mrd.samples (feeds mrd.preview)
 
         for (int i = 1; i < argc; ++i)
         {
@@ -59,6 +39,14 @@ int main(int argc, char **argv)
                 ws_url = argv[++i];
             else if (a == "--data" && i + 1 < argc)
                 data = argv[++i];
+            else if (a == "--shm" && i + 1 < argc)
+                shm_name = argv[++i];
+            else if (a == "--trace-every" && i + 1 < argc)
+                trace_every = std::stoull(argv[++i]);
+            else if (a == "--batch" && i + 1 < argc)
+                batch = std::stoull(argv[++i]);
+            else if (a == "--samples")
+                samples = true;
         }
 
         const fs::path latest = fs::path(data) / "latest.json";
@@ -92,27 +80,88 @@ int main(int argc, char **argv)
         const uint64_t n = d.getNumberOfAcquisitions();
         std::cerr << "Acquisitions: " << n << "\n";
 
-        // connect WS once
-        boost::asio::io_context ioc;
-        std::string host, port, target;
-        parse_ws_url(ws_url, host, port, target);
+        // connect WS (reconnecting, frames queue meanwhile), or attach to the local shared-memory queue
+        std::shared_ptr<client::WsClient> ws;
+        std::unique_ptr<shm::ShmQueue> shm_q;
+        auto connect_ws = [&]
+        {
+            client::WsOptions opt;
+            opt.batch_max = batch;
+            ws = client::WsClient::create(ioc, client::parse_url(ws_url), opt);
+            ws->on_status([&](bool up, boost::beast::error_code ec)
+                          { std::cerr << "WebSocket " << (up ? "connected to " + ws_url : "lost: " + ec.message()) << "\n"; });
+            ws->start();
+            io = std::thread([&] { ioc.run(); });
+        };
+        auto attach_shm = [&]
+        {
+            shm_q = std::make_unique<shm::ShmQueue>(shm::Region::attach_wait(shm_name + ".in"));
+            std::cerr << "Shared memory attached: " << shm_name << ".in\n";
+        };
+        if (!shm_name.empty())
+            attach_shm();
+        else
+            connect_ws();
+        // stale() costs three syscalls, so it runs only when a push fails and
+        // at most once a second otherwise; the latter bounds how many frames
+        // go into the queue of a marshal that restarted while it was not full
+        auto shm_checked = std::chrono::steady_clock::now();
+        auto send = [&](const std::string &f)
+        {
+            if (shm_q && f.size() <= shm_q->slot_bytes())
+            {
+                const auto now = std::chrono::steady_clock::now();
+                bool pushed = now - shm_checked < std::chrono::seconds(1) && shm_q->push(f);
+                if (!pushed)
+                {
+                    shm_checked = now;
+                    // a restarted marshal recreates the queue; follow it
+                    if (shm_q->stale())
+                    {
+                        std::cerr << "Shared memory queue was replaced; reattaching\n";
+                        attach_shm();
+                    }
+                    pushed = shm_q->push(f);
+                }
+                if (pushed)
+                    return;
+                // a queue that stays full has no live consumer: give it up
+                std::cerr << "Shared memory queue stayed full; sending all frames via " << ws_url << "\n";
+                shm_q.reset();
+            }
+            // frames larger than a shm slot go over the WebSocket instead
+            if (!ws)
+            {
+                if (shm_q)
+                    std::cerr << "frame of " << f.size() << " bytes exceeds the shm slot size; sending oversize frames via " << ws_url << "\n";
+                connect_ws();
+            }
+            ws->send(f);
+        };
 
-        boost::asio::ip::tcp::resolver res{ioc};
-        auto const results = res.resolve(host, port);
-        boost::asio::ip::tcp::socket sock{ioc};
-        boost::asio::connect(sock, results.begin(), results.end());
-        websocket::stream<boost::asio::ip::tcp::socket> ws{std::move(sock)};
-        ws.handshake(host, target); // Host header is just host (no port) which is fine for local
-        std::cerr << "WebSocket connected to " << ws_url << "\n";
+        trace::Sampler sampler(trace_every, static_cast<uint64_t>(::getpid()) << 32);
 
         // naive pacing: one-by-one with small delay
         for (uint64_t i = 0; i < n; ++i)
         {
             ISMRMRD::Acquisition acq;
             d.readAcquisition(i, acq);
-            ws_send(ws, json{
-                            {"topic", "mrd.acq"},
-                            {"payload", {{"idx", i}}}});
+            if (samples)
+            {
+                // channel-major complex float, as ISMRMRD stores it
+                const auto c = acq.active_channels(), ns = acq.number_of_samples();
+                const json p{{"idx", i},
+                             {"channels", c},
+                             {"n", ns},
+                             {"iq", base64::encode(acq.getDataPtr(), size_t{c} * ns * sizeof(*acq.getDataPtr()))}};
+                // topic first: the marshal hands the frame to its preview stage without parsing it
+                send(R"({"topic":"mrd.samples","payload":)" + p.dump() + "}");
+            }
+            json frame{
+                {"topic", "mrd.acq"},
+                {"payload", {{"idx", i}}}};
+            sampler.maybe_attach(frame);
+            send(frame.dump());
             std::this_thread::sleep_for(std::chrono::milliseconds(5));
             if (i % 100 == 0 || i + 1 == n)
             {
@@ -120,13 +169,22 @@ int main(int argc, char **argv)
             }
         }
 
-        // close politely
-        ws.close(websocket::close_code::normal);
+        // flush what is queued, then close politely
+        if (ws)
+        {
+            ws->close();
+            io.join();
+            if (ws->dropped())
+                std::cerr << "WebSocket dropped " << ws->dropped() << " unsent frames\n";
+        }
         return 0;
     }
     catch (const std::exception &e)
     {
         std::cerr << "playback error: " << e.what() << "\n";
+        ioc.stop();
+        if (io.joinable())
+            io.join();
         return 1;
     }
 }
@@ -0,0 +1,229 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/xxh64.hpp"
+
+// -------- content-addressed blob storage --------
+//
+// Stores each distinct blob once, as ${data_dir}/mrd/cas/<hh>/<hash>.mrd,
+// keyed by its XXH64. Every index entry that refers to a blob counts as one
+// reference; a blob is deleted once retention has dropped its last entry.
+// Reference counts live in memory and are rebuilt from the index at startup.
+//
+// A hash match is confirmed byte for byte before an upload is folded into
+// an existing blob; on a genuine collision the caller stores a plain file.
+//
+// The startup rebuild (adopt, then sweep) may run alongside ingest: sweep
+// leaves the temporaries of uploads in progress alone.
+
+struct CasRef {
+    std::string path;
+    uint64_t    length{0};
+    bool        dup{false};  // an identical blob was already stored
+};
+
+class CasStore {
+    struct Blob {
+        uint64_t length;
+        uint64_t refs;  // index entries referring to it; 0 = awaiting reap()
+    };
+
+    std::filesystem::path root_;
+    std::mutex m_;
+    std::unordered_map<uint64_t, Blob> blobs_;
+    std::unordered_set<std::string> writing_;  // temporaries of uploads in progress
+    std::atomic<uint64_t> tmp_seq_{0};
+
+public:
+    std::atomic<uint64_t> stored_bytes{0};  // distinct blobs on disk
+    std::atomic<uint64_t> dup_hits{0};      // uploads folded into an existing blob
+    std::atomic<uint64_t> saved_bytes{0};   // bytes those uploads did not write
+
+    explicit CasStore(std::filesystem::path root) : root_(std::move(root)) {
+        std::error_code ec;
+        std::filesystem::create_directories(root_, ec);
+        if (ec) throw std::runtime_error("create cas dir failed: " + ec.message());
+    }
+
+    CasStore(const CasStore&) = delete;
+    CasStore& operator=(const CasStore&) = delete;
+
+    static std::string hex(uint64_t h) {
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+        return buf;
+    }
+
+    static bool parse_hex(std::string_view s, uint64_t& h) {
+        if (s.size() != 16) return false;
+        h = 0;
+        for (char c : s) {
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (d < 0) return false;
+            h = h << 4 | static_cast<uint64_t>(d);
+        }
+        return true;
+    }
+
+    std::filesystem::path path_for(uint64_t h) const {
+        auto name = hex(h);
+        return root_ / name.substr(0, 2) / (name + ".mrd");
+    }
+
+    // Stores one blob whose XXH64 is h, or takes a reference on its stored
+    // twin. Returns nullopt when a different blob already owns the hash.
+    std::optional<CasRef> put(const void* data, size_t n, uint64_t h) {
+        namespace fs = std::filesystem;
+        const auto path = path_for(h);
+        fs::path tmp = path;
+        tmp += ".tmp" + std::to_string(tmp_seq_.fetch_add(1));
+        bool pinned = false;
+        {
+            std::scoped_lock lk(m_);
+            if (auto it = blobs_.find(h); it != blobs_.end()) {
+                if (it->second.length != n) return std::nullopt;
+                ++it->second.refs;  // pins the file while it is compared below
+                pinned = true;
+            } else {
+                writing_.insert(tmp.string());
+            }
+        }
+        if (!pinned) {
+            // write the first copy outside the lock; publish it with a rename
+            try {
+                write_file(tmp, data, n);
+            } catch (...) {
+                std::scoped_lock lk(m_);
+                writing_.erase(tmp.string());
+                throw;
+            }
+            std::scoped_lock lk(m_);
+            writing_.erase(tmp.string());
+            auto [it, fresh] = blobs_.try_emplace(h, Blob{n, 1});
+            std::error_code ec;
+            if (fresh) {
+                fs::rename(tmp, path, ec);
+                if (ec) {
+                    blobs_.erase(it);
+                    fs::remove(tmp, ec);
+                    throw std::runtime_error("publish cas blob failed: " + path.string());
+                }
+                stored_bytes += n;
+                return CasRef{path.string(), n, false};
+            }
+            fs::remove(tmp, ec);  // a concurrent upload of the same hash won
+            if (it->second.length != n) return std::nullopt;
+            ++it->second.refs;
+        }
+        if (same_bytes(path, data, n)) {
+            ++dup_hits;
+            saved_bytes += n;
+            return CasRef{path.string(), n, true};
+        }
+        if (release(h)) reap(h);
+        return std::nullopt;
+    }
+
+    // Counts one existing index reference to h (startup rebuild).
+    void adopt(uint64_t h, uint64_t length) {
+        std::scoped_lock lk(m_);
+        auto [it, fresh] = blobs_.try_emplace(h, Blob{length, 0});
+        if (fresh) stored_bytes += length;
+        ++it->second.refs;
+    }
+
+    // Drops one reference; true when none are left. The file stays until
+    // reap(), so an upload arriving meanwhile can still reuse it.
+    bool release(uint64_t h) {
+        std::scoped_lock lk(m_);
+        auto it = blobs_.find(h);
+        if (it == blobs_.end()) return false;
+        if (it->second.refs) --it->second.refs;
+        return it->second.refs == 0;
+    }
+
+    // Deletes h if it is still unreferenced; returns the bytes freed.
+    uint64_t reap(uint64_t h) {
+        std::scoped_lock lk(m_);
+        auto it = blobs_.find(h);
+        if (it == blobs_.end() || it->second.refs) return 0;
+        std::error_code ec;
+        const auto path = path_for(h);
+        auto sz = std::filesystem::file_size(path, ec);
+        if (ec) sz = 0;
+        std::filesystem::remove(path, ec);
+        stored_bytes -= it->second.length;
+        blobs_.erase(it);
+        return sz;
+    }
+
+    // Removes files no index entry refers to: blobs whose last reference was
+    // dropped by an interrupted retention pass, and temporaries left by
+    // uploads that did not finish. Uploads in progress are not touched.
+    uint64_t sweep() {
+        namespace fs = std::filesystem;
+        std::scoped_lock lk(m_);
+        uint64_t removed = 0;
+        std::error_code ec;
+        std::vector<fs::path> orphans;
+        for (auto& de : fs::recursive_directory_iterator(root_, ec)) {
+            if (!de.is_regular_file(ec)) continue;
+            uint64_t h;
+            const auto& p = de.path();
+            if (p.extension() == ".mrd" && parse_hex(p.stem().string(), h) && blobs_.count(h)) continue;
+            if (writing_.count(p.string())) continue;
+            orphans.push_back(p);
+        }
+        for (auto& p : orphans)
+            if (fs::remove(p, ec)) ++removed;
+        return removed;
+    }
+
+    nlohmann::json to_json() {
+        size_t n;
+        { std::scoped_lock lk(m_); n = blobs_.size(); }
+        return {{"blobs", n},
+                {"stored_bytes", stored_bytes.load()},
+                {"dup_hits", dup_hits.load()},
+                {"saved_bytes", saved_bytes.load()}};
+    }
+
+private:
+    static void write_file(const std::filesystem::path& p, const void* data, size_t n) {
+        std::error_code ec;
+        std::filesystem::create_directories(p.parent_path(), ec);
+        std::ofstream f(p, std::ios::binary | std::ios::trunc);
+        if (!f) throw std::runtime_error("open cas blob failed: " + p.string());
+        f.write(static_cast<const char*>(data), static_cast<std::streamsize>(n));
+        if (!f) throw std::runtime_error("write cas blob failed: " + p.string());
+    }
+
+    static bool same_bytes(const std::filesystem::path& p, const void* data, size_t n) {
+        std::ifstream f(p, std::ios::binary);
+        auto q = static_cast<const char*>(data);
+        char buf[1 << 16];
+        while (n) {
+            const size_t k = std::min(n, sizeof(buf));
+            if (!f.read(buf, static_cast<std::streamsize>(k)) || std::memcmp(buf, q, k) != 0) return false;
+            q += k;
+            n -= k;
+        }
+        return f.peek() == std::ifstream::traits_type::eof();
+    }
+};
@@ -11,46 +11,26 @@
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <optional>
+#include <vector>
 #include <string>
 #include <thread>
 #include <cstdlib>
 #include <atomic>
 #include <chrono>
 #include <iomanip>
+#include <random>
 #include <sstream>
 
 #include "marshal_state.hpp"
+#include "marshal_index.hpp"
+#include "marshal_time.hpp"
+#include "common/xxh64.hpp"
 
 namespace http = boost::beast::http;
 namespace fs   = std::filesystem;
 
-// -------- time / fs helpers --------
-
-// RFC3339 UTC with milliseconds (e.g., 2025-09-12T14:59:01.234Z)
-inline std::string iso8601_now_ms() {
-    using namespace std::chrono;
-    auto now = time_point_cast<milliseconds>(system_clock::now());
-    auto ms  = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
-    std::time_t tt = system_clock::to_time_t(now);
-    std::tm tm = *std::gmtime(&tt);
-
-    char base[32];
-    std::strftime(base, sizeof(base), "%Y-%m-%dT%H:%M:%S", &tm);
-
-    std::ostringstream oss;
-    oss << base << '.' << std::setw(3) << std::setfill('0') << ms.count() << 'Z';
-    return oss.str();
-}
-
-// Seconds-precision ISO8601 for pose endpoint (keeps your original behavior)
-inline std::string iso8601_now() {
-    using namespace std::chrono;
-    auto now = system_clock::now();
-    auto t   = system_clock::to_time_t(now);
-    char buf[64];
-    std::strftime(buf, sizeof(buf), "%FT%TZ", std::gmtime(&t));
-    return buf;
-}
+// -------- fs helpers --------
 
 inline void ensure_dir(const fs::path& p) {
     std::error_code ec;
@@ -93,7 +73,171 @@ inline bool read_file_all(const fs::path& p, std::string& out) {
     return true;
 }
 
-static std::atomic<uint64_t> g_seq{1}; // per-process sequence for filenames
+// Name of the next "files" mode blob: a random per-process prefix and a
+// counter. Unique across restarts without standing for the entry's ts or seq,
+// which commit_entries assigns later.
+inline std::string next_blob_name() {
+    static const uint64_t prefix = [] {
+        std::random_device rd;
+        return (uint64_t{rd()} << 32) | rd();
+    }();
+    static std::atomic<uint64_t> counter{1};
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << prefix << '_' << std::dec << std::setw(6)
+         << counter.fetch_add(1) << ".mrd";
+    return name.str();
+}
+
+// -------- MRD blob storage --------
+
+// Stores blobs under ${data_dir}/mrd and returns one index entry per blob,
+// without "ts" and "seq" (commit_entries assigns those in index order).
+// "files" mode writes one file per blob (next_blob_name()); "segments" mode appends them
+// to the active segment file and records (segment, offset, length); "cas"
+// mode stores each distinct blob once and records its path and hash.
+// `hashes` optionally carries the XXH64 of each blob, computed while the
+// request body was received.
+inline nlohmann::json store_blobs(MarshalState& state, const std::vector<std::pair<const char*, size_t>>& blobs,
+                                  const std::vector<uint64_t>& hashes = {}) {
+    using nlohmann::json;
+    fs::path mrd_root = fs::path(state.data_dir) / "mrd";
+    ensure_dir(mrd_root);
+
+    json entries = json::array();
+
+    auto store_file = [&](const char* data, size_t n) {
+        fs::path out_path = mrd_root / next_blob_name();
+
+        write_atomic(out_path, data, n);
+
+        std::error_code ec;
+        auto size_bytes = fs::file_size(out_path, ec);
+        if (ec) size_bytes = n;
+
+        entries.push_back({{"path", out_path.string()}, {"size_bytes", size_bytes}, {"type", "acq"}});
+    };
+
+    if (state.segments) {
+        auto refs = state.segments->append_many(blobs);
+        for (auto& r : refs) {
+            entries.push_back({{"segment", r.segment}, {"offset", r.offset}, {"length", r.length},
+                               {"size_bytes", r.length}, {"type", "acq"}});
+        }
+        return entries;
+    }
+
+    if (state.cas) {
+        for (size_t i = 0; i < blobs.size(); ++i) {
+            auto [data, n] = blobs[i];
+            const uint64_t h = i < hashes.size() ? hashes[i] : xxh64::hash(data, n);
+            auto ref = state.cas->put(data, n, h);
+            if (!ref) {  // hash collision with a different blob: keep this one as a plain file
+                store_file(data, n);
+                continue;
+            }
+            entries.push_back({{"path", ref->path}, {"hash", CasStore::hex(h)}, {"size_bytes", n},
+                               {"type", "acq"}});
+            if (ref->dup) entries.back()["dedup"] = true;
+        }
+        return entries;
+    }
+
+    for (auto& [data, n] : blobs) store_file(data, n);
+    return entries;
+}
+
+// Appends entries to index.jsonl in one write, points latest.json at the last
+// one, mirrors both in the in-memory index and announces the entries on the
+// "mrd.index" topic. Entries without a "ts" (local ingest) get "ts" and "seq"
+// under the index lock, so both increase in index order however many
+// requests commit concurrently; replicated entries keep theirs. Returns the
+// entries as committed.
+inline nlohmann::json commit_entries(MarshalState& state, nlohmann::json entries) {
+    if (entries.empty()) return entries;
+    fs::path mrd_root = fs::path(state.data_dir) / "mrd";
+    IndexCache::Rows rows;
+    rows.reserve(entries.size());
+
+    {
+        std::scoped_lock lk(state.index_mtx);
+        const std::string ts = iso8601_now_ms();
+        std::string lines;
+        for (auto& e : entries) {
+            if (!e.contains("ts")) {
+                e["ts"]  = ts;
+                e["seq"] = ++state.index_seq;
+            }
+            auto row = std::make_shared<IndexRow>();
+            row->line = e.dump();
+            if (e["ts"].is_string()) row->set_ts(e["ts"].get<std::string>());
+            lines += row->line;
+            lines += '\n';
+            rows.push_back(std::move(row));
+        }
+        lines.pop_back();
+        append_line(mrd_root / "index.jsonl", lines);
+        std::string latest_dump = rows.back()->line;
+        write_atomic(mrd_root / "latest.json", latest_dump.data(), latest_dump.size());
+        state.index_cache.append(std::move(rows), std::move(latest_dump));
+    }
+    // relays (and any other subscriber) replicate the index from this topic
+    if (state.publish)
+        state.publish(nlohmann::json{{"topic", "mrd.index"}, {"payload", {{"entries", entries}}}}.dump());
+    return entries;
+}
+
+// Splits a batch body of length-prefixed blobs: repeated [u32 little-endian length][bytes].
+inline bool parse_batch(const std::string& body, std::vector<std::pair<const char*, size_t>>& out) {
+    size_t pos = 0;
+    while (pos < body.size()) {
+        if (body.size() - pos < 4) return false;
+        auto b = reinterpret_cast<const unsigned char*>(body.data() + pos);
+        size_t n = size_t(b[0]) | size_t(b[1]) << 8 | size_t(b[2]) << 16 | size_t(b[3]) << 24;
+        pos += 4;
+        if (n == 0 || body.size() - pos < n) return false;
+        out.emplace_back(body.data() + pos, n);
+        pos += n;
+    }
+    return !out.empty();
+}
+
+// Request body that hashes bytes as they arrive when `hashing` is set, so a
+// content-addressed ingest does not make a second pass over a large upload.
+struct HashingBody {
+    struct value_type : std::string {
+        bool hashing{false};
+        xxh64::State hash;
+    };
+
+    static std::uint64_t size(const value_type& v) { return v.size(); }
+
+    class reader {
+        value_type& body_;
+
+    public:
+        template <bool isRequest, class Fields>
+        reader(http::header<isRequest, Fields>&, value_type& b) : body_(b) {}
+
+        void init(const boost::optional<std::uint64_t>& length, boost::beast::error_code& ec) {
+            if (length) body_.reserve(static_cast<size_t>(*length));
+            body_.hash.reset();
+            ec = {};
+        }
+
+        template <class ConstBufferSequence>
+        std::size_t put(const ConstBufferSequence& buffers, boost::beast::error_code& ec) {
+            const size_t n = boost::asio::buffer_size(buffers);
+            const size_t at = body_.size();
+            body_.resize(at + n);
+            boost::asio::buffer_copy(boost::asio::buffer(body_.data() + at, n), buffers);
+            if (body_.hashing) body_.hash.update(body_.data() + at, n);
+            ec = {};
+            return n;
+        }
+
+        void finish(boost::beast::error_code& ec) { ec = {}; }
+    };
+};
 
 // -------- HTTP server --------
 
@@ -122,38 +266,116 @@ private:
     }
 
     struct Session : std::enable_shared_from_this<Session> {
-        boost::asio::ip::tcp::socket socket;
+        boost::beast::tcp_stream     stream;
         boost::beast::flat_buffer    buffer;
-        http::request<http::string_body> req;
+        std::optional<http::request_parser<HashingBody>> parser;
+        http::request<HashingBody> req;
         MarshalState &state;
+        bool bulk{false};
+        bool close_after{false};
 
         Session(boost::asio::ip::tcp::socket &&s, MarshalState &st)
-            : socket(std::move(s)), state(st) {}
+            : stream(std::move(s)), state(st) {}
 
-        void run() { do_read(); }
+        void run() {
+            stream.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+            do_read();
+        }
 
+        // Keep-alive: the next request is read on the same connection (pipelined
+        // requests wait in `buffer`); idle connections are closed after 60 s.
+        // The header is read first so bulk requests can be turned away before
+        // their body is uploaded.
         void do_read() {
             auto self = shared_from_this();
-            http::async_read(socket, buffer, req, [self](auto ec, auto) {
-                if (!ec) self->handle();
+            parser.emplace();
+            parser->body_limit(state.max_body_bytes); // batch uploads exceed beast's 1 MiB default
+            close_after = false;
+            stream.expires_after(std::chrono::seconds(60));
+            http::async_read_header(stream, buffer, *parser, [self](auto ec, auto) {
+                if (ec) return;
+                auto target = self->parser->get().target();
+                self->bulk  = classify({target.data(), target.size()}) == RouteClass::Bulk;
+                self->parser->get().body().hashing = self->state.cas && target == "/v1/mrd/ingest";
+                if (self->bulk && self->state.sched) {
+                    auto& sched = *self->state.sched;
+                    if (!sched.admit(self->client_ip())) return self->reject(http::status::too_many_requests, "rate limited");
+                    if (!sched.accepting()) return self->reject(http::status::service_unavailable, "bulk queue full");
+                }
+                self->stream.expires_after(std::chrono::seconds(60));
+                http::async_read(self->stream, self->buffer, *self->parser, [self](auto ec, auto) {
+                    if (ec) return;
+                    self->req = self->parser->release();
+                    self->route();
+                });
             });
         }
 
-        // FIX: keep response alive through async_write
+        // Critical routes run here on the io thread, bulk ones on the pool.
+        void route() {
+            if (!bulk || !state.sched) {
+                if (state.sched) ++state.sched->stats.critical;
+                return handle();
+            }
+            auto self = shared_from_this();
+            if (!state.sched->submit([self] { self->handle(); },
+                                     [self](const std::string& what) { self->fail(what); }))
+                reject(http::status::service_unavailable, "bulk queue full");
+        }
+
+        std::string client_ip() {
+            boost::system::error_code ec;
+            auto ep = stream.socket().remote_endpoint(ec);
+            return ec ? std::string() : ep.address().to_string();
+        }
+
+        // Refuses the current request; its body may be unread, so the
+        // connection is closed after the response.
+        void reject(http::status st, const char* why) {
+            if (!parser->is_done()) {
+                req = http::request<HashingBody>(parser->get().base());
+                close_after = true;
+            }
+            http::response<http::string_body> res{st, req.version()};
+            res.set(http::field::content_type, "application/json");
+            if (st == http::status::too_many_requests) res.set(http::field::retry_after, "1");
+            res.body() = nlohmann::json{{"error", why}}.dump();
+            res.prepare_payload();
+            respond(std::move(res));
+        }
+
+        // 500 for a bulk request whose handler threw.
+        void fail(const std::string& what) {
+            http::response<http::string_body> res{http::status::internal_server_error, req.version()};
+            res.set(http::field::content_type, "application/json");
+            res.body() = nlohmann::json{{"error", "internal error"}, {"what", what}}.dump();
+            res.prepare_payload();
+            respond(std::move(res));
+        }
+
+        // FIX: keep response alive through async_write. May be called from a
+        // bulk pool thread; the write is started on the connection's executor.
         void respond(http::response<http::string_body> &&res) {
             auto self = shared_from_this();
             auto sp   = std::make_shared<http::response<http::string_body>>(std::move(res));
             sp->set(http::field::server, "marshal-beast");
-
-            http::async_write(socket, *sp, [self, sp](boost::beast::error_code, std::size_t) {
-                boost::system::error_code ignored;
-                self->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+            sp->keep_alive(req.keep_alive() && !close_after);
+
+            boost::asio::dispatch(stream.get_executor(), [self, sp] {
+                // a bulk request may have queued for most of the read deadline
+                self->stream.expires_after(std::chrono::seconds(60));
+                http::async_write(self->stream, *sp, [self, sp](boost::beast::error_code ec, std::size_t) {
+                    if (!ec && sp->keep_alive()) return self->do_read();
+                    boost::system::error_code ignored;
+                    self->stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+                });
             });
         }
 
         // crude parser for ?ts=…&limit=…
-        static inline void parse_ts_limit(const std::string& target, std::string& ts, size_t& limit) {
-            ts.clear(); limit = 0;
+        // ts=X selects entries after X, from=X entries at or after X
+        static inline void parse_ts_limit(const std::string& target, std::string& ts, size_t& limit, bool& inclusive) {
+            ts.clear(); limit = 0; inclusive = false;
             auto qpos = target.find('?');
             if (qpos == std::string::npos) return;
             auto qp = target.substr(qpos + 1);
@@ -166,6 +388,7 @@ private:
                 return (a == std::string::npos) ? v : v.substr(0, a);
             };
             ts = get("ts");
+            if (ts.empty()) { ts = get("from"); inclusive = !ts.empty(); }
             auto lim = get("limit");
             if (!lim.empty()) { try { limit = static_cast<size_t>(std::stoull(lim)); } catch(...) {} }
         }
@@ -196,6 +419,63 @@ private:
                 return respond(std::move(res));
             }
 
+            // POST /v1/pose/update  ({"p":[x,y,z], "R":[9 row-major], "source":..., "frame":...})
+            if (req.method() == http::verb::post && req.target() == "/v1/pose/update") {
+                auto j = json::parse(req.body(), nullptr, false);
+                Pose p;
+                const bool ok = pose_from_json(j, p);
+                http::response<http::string_body> res{ok ? http::status::ok : http::status::bad_request, req.version()};
+                res.set(http::field::content_type, "application/json");
+                if (ok) {
+                    p.t = std::chrono::system_clock::now();
+                    state.poses.set(p);
+                    res.body() = json{{"pose", pose_to_json(p)}}.dump();
+                    if (state.publish)
+                        state.publish(json{{"topic", "pose"}, {"payload", pose_to_json(p)}}.dump());
+                } else {
+                    res.body() = json{{"error","expected {\"p\":[3 numbers], \"R\":[9 numbers], \"frame\"/\"source\": strings}"}}.dump();
+                }
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
+            // GET /v1/sched  (request classes, admission and bulk pool counters)
+            if (req.method() == http::verb::get && req.target() == "/v1/sched") {
+                http::response<http::string_body> res{http::status::ok, req.version()};
+                res.set(http::field::content_type, "application/json");
+                res.body() = (state.sched ? state.sched->to_json() : json{{"enabled", false}}).dump();
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
+            // GET /v1/relay  (upstream link and local subscriber backpressure)
+            if (req.method() == http::verb::get && req.target() == "/v1/relay") {
+                const auto& rs = state.relay_stats;
+                http::response<http::string_body> res{http::status::ok, req.version()};
+                res.set(http::field::content_type, "application/json");
+                json up = nullptr;
+                if (!state.upstream.empty())
+                    up = {{"url", state.upstream},
+                          {"connected", rs.connected.load()},
+                          {"connects", rs.connects.load()},
+                          {"frames", rs.frames.load()},
+                          {"index_entries", rs.index_entries.load()},
+                          {"backfills", rs.backfills.load()},
+                          {"gaps", rs.gaps.load()},
+                          {"upstream_seq", rs.upstream_seq.load()}};
+                json shm = nullptr;
+                if (state.shm_out)
+                    shm = {{"slot_bytes", state.shm_out->slot_bytes()},
+                           {"oversize_dropped", state.shm_oversize.load()}};
+                res.body() = json{{"upstream", up},
+                                  {"subscribers", {{"max_queue", state.ws_max_queue},
+                                                   {"lagged", state.ws_lagged.load()},
+                                                   {"gaps", state.ws_gaps.load()}}},
+                                  {"shm", shm}}.dump();
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
             // GET /v1/config
             if (req.method() == http::verb::get && req.target() == "/v1/config") {
                 http::response<http::string_body> res{http::status::ok, req.version()};
@@ -203,13 +483,73 @@ private:
                 res.body() = json{
                     {"data_dir", state.data_dir},
                     {"ws_port", 8090},
-                    {"max_entries", 100000}
+                    {"max_entries", state.retention.max_entries},
+                    {"max_age_s", state.retention.max_age.count()},
+                    {"max_bytes", state.retention.max_bytes},
+                    {"storage", state.storage},
+                    {"segment_bytes", state.segment_bytes},
+                    {"segment_keep", state.segment_keep},
+                    {"cas", state.cas ? state.cas->to_json() : json(nullptr)}
+                }.dump();
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
+            // GET /v1/index  (in-memory index, startup load and snapshots)
+            if (req.method() == http::verb::get && req.target() == "/v1/index") {
+                const auto& st = state.index_stats;
+                http::response<http::string_body> res{http::status::ok, req.version()};
+                res.set(http::field::content_type, "application/json");
+                res.body() = json{
+                    {"entries", state.index_cache.size()},
+                    {"complete", state.index_cache.complete()},
+                    {"loaded", st.loaded.load()},
+                    {"load", {{"from_snapshot", st.from_snapshot.load()},
+                              {"snapshot_rows", st.snapshot_rows.load()},
+                              {"tail_rows", st.tail_rows.load()},
+                              {"startup_ms", st.startup_ms.load()},
+                              {"backfill_ms", st.backfill_ms.load()}}},
+                    {"snapshots", {{"interval_s", state.snapshot_interval.count()},
+                                   {"written", st.snapshots.load()},
+                                   {"last_ms", st.last_snapshot_ms.load()}}}
+                }.dump();
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
+            // GET /v1/retention  (policy and progress of the background retention task)
+            if (req.method() == http::verb::get && req.target() == "/v1/retention") {
+                const auto& st = state.retention_stats;
+                http::response<http::string_body> res{http::status::ok, req.version()};
+                res.set(http::field::content_type, "application/json");
+                res.body() = json{
+                    {"policy", {{"max_age_s", state.retention.max_age.count()},
+                                {"max_bytes", state.retention.max_bytes},
+                                {"max_entries", state.retention.max_entries},
+                                {"interval_s", state.retention.interval.count()}}},
+                    {"running", st.running.load()},
+                    {"passes", st.passes.load()},
+                    {"progress", {{"scanned", st.scanned.load()}, {"total", st.total.load()}}},
+                    {"entries_removed", st.entries_removed.load()},
+                    {"bytes_reclaimed", st.bytes_reclaimed.load()},
+                    {"last_pass_ms", st.last_pass_ms.load()}
                 }.dump();
                 res.prepare_payload();
                 return respond(std::move(res));
             }
 
-            // POST /v1/mrd/ingest  (writes ${data_dir}/mrd/*.mrd and updates index/latest)
+            // GET /v1/trace/stats  (per-hop latency of sampled frames)
+            if (req.method() == http::verb::get && req.target() == "/v1/trace/stats") {
+                http::response<http::string_body> res{http::status::ok, req.version()};
+                res.set(http::field::content_type, "application/json");
+                json j{{"hops", state.trace_stats.to_json()}, {"reports", state.trace_reports.load()}};
+                if (state.trace_dump) j["dump_dropped"] = state.trace_dump->dropped();
+                res.body() = j.dump();
+                res.prepare_payload();
+                return respond(std::move(res));
+            }
+
+            // POST /v1/mrd/ingest  (writes ${data_dir}/mrd/*.mrd, a segment or a cas blob, then updates index/latest)
             if (req.method() == http::verb::post && req.target() == "/v1/mrd/ingest") {
                 try {
                     const std::string& body = req.body();
@@ -222,32 +562,44 @@ private:
                         return respond(std::move(res));
                     }
 
-                    fs::path mrd_root = fs::path(state.data_dir) / "mrd";
-                    ensure_dir(mrd_root);
+                    std::vector<uint64_t> hashes;
+                    if (req.body().hashing) hashes.push_back(req.body().hash.digest());
+                    auto entries = commit_entries(state, store_blobs(state, {{body.data(), body.size()}}, hashes));
+                    const json& entry = entries.back();
 
-                    const std::string ts = iso8601_now_ms();
-                    const uint64_t seq   = g_seq.fetch_add(1);
-                    std::ostringstream name;
-                    name << ts << '_' << std::setw(6) << std::setfill('0') << seq << ".mrd";
-                    fs::path out_path = mrd_root / name.str();
-
-                    write_atomic(out_path, body.data(), body.size());
-
-                    std::error_code ec;
-                    auto size_bytes = fs::file_size(out_path, ec);
-                    if (ec) size_bytes = body.size();
+                    http::response<http::string_body> res{http::status::created, req.version()};
+                    res.set(http::field::content_type, "application/json");
+                    res.body() = entry.dump();
+                    res.prepare_payload();
+                    return respond(std::move(res));
+                } catch (const std::exception& e) {
+                    json j = {{"error","ingest failed"},{"what", e.what()}};
+                    http::response<http::string_body> res{http::status::internal_server_error, req.version()};
+                    res.set(http::field::content_type, "application/json");
+                    res.body() = j.dump();
+                    res.prepare_payload();
+                    return respond(std::move(res));
+                }
+            }
 
-                    json entry = {{"path", out_path.string()}, {"ts", ts}, {"size_bytes", size_bytes}, {"type", "acq"},
-                    {"seq",  seq}};
+            // POST /v1/mrd/ingest/batch  (body: repeated [u32 LE length][blob]; one index append per batch)
+            if (req.method() == http::verb::post && req.target() == "/v1/mrd/ingest/batch") {
+                try {
+                    std::vector<std::pair<const char*, size_t>> blobs;
+                    if (!parse_batch(req.body(), blobs)) {
+                        json j = {{"error","malformed batch"}};
+                        http::response<http::string_body> res{http::status::bad_request, req.version()};
+                        res.set(http::field::content_type, "application/json");
+                        res.body() = j.dump();
+                        res.prepare_payload();
+                        return respond(std::move(res));
+                    }
 
-                    //fs::path meta_root = fs::path(state.data_dir);
-                    append_line(mrd_root / "index.jsonl", entry.dump());
-                    const std::string latest_dump = entry.dump();
-                    write_atomic(mrd_root / "latest.json", latest_dump.data(), latest_dump.size());
+                    auto entries = commit_entries(state, store_blobs(state, blobs));
 
                     http::response<http::string_body> res{http::status::created, req.version()};
                     res.set(http::field::content_type, "application/json");
-                    res.body() = entry.dump();
+                    res.body() = json{{"count", entries.size()}, {"entries", entries}}.dump();
                     res.prepare_payload();
                     return respond(std::move(res));
                 } catch (const std::exception& e) {
@@ -260,12 +612,14 @@ private:
                 }
             }
 
-            // GET /v1/mrd/latest  (reads ${data_dir}/mrd/latest.json)
+            // GET /v1/mrd/latest  (in-memory copy of ${data_dir}/mrd/latest.json)
             if (req.method() == http::verb::get && req.target() == "/v1/mrd/latest") {
                 fs::path latest = fs::path(state.data_dir) / "mrd" / "latest.json";
                 http::response<http::string_body> res{http::status::ok, req.version()};
                 res.set(http::field::content_type, "application/json");
-                if (fs::exists(latest)) {
+                if (auto cached = state.index_cache.latest(); !cached.empty()) {
+                    res.body() = std::move(cached);
+                } else if (fs::exists(latest)) {
                     std::string s;
                     if (read_file_all(latest, s) && !s.empty()) {
                         res.body() = s;
@@ -281,13 +635,14 @@ private:
                 return respond(std::move(res));
             }
 
-            // GET /v1/mrd/since?ts=...&limit=...  (reads ${data_dir}/mrd/index.jsonl)
+            // GET /v1/mrd/since?ts=...&limit=...  (in-memory index; scans ${data_dir}/mrd/index.jsonl
+            // while older history is still loading). from=... instead of ts includes entries at that ts.
             if (req.method() == http::verb::get && std::string(req.target()).rfind("/v1/mrd/since", 0) == 0) {
                 http::response<http::string_body> res{http::status::ok, req.version()};
                 res.set(http::field::content_type, "application/json");
                 try {
-                    std::string ts; size_t limit = 0;
-                    parse_ts_limit(std::string(req.target()), ts, limit);
+                    std::string ts; size_t limit = 0; bool inclusive = false;
+                    parse_ts_limit(std::string(req.target()), ts, limit, inclusive);
                     if (ts.empty()) {
                         nlohmann::json j = {{"error","missing ts param"}};
                         res.result(http::status::bad_request);
@@ -296,6 +651,11 @@ private:
                         return respond(std::move(res));
                     }
 
+                    if (state.index_cache.since(ts, limit, res.body(), inclusive)) {
+                        res.prepare_payload();
+                        return respond(std::move(res));
+                    }
+
                    // fs::path index = fs::path(state.data_dir) / "index.jsonl";
                     fs::path index = fs::path(state.data_dir) / "mrd" / "index.jsonl";
                     nlohmann::json out = nlohmann::json::array();
@@ -307,7 +667,9 @@ private:
                             if (line.empty()) continue;
                             nlohmann::json j = nlohmann::json::parse(line, nullptr, false);
                             if (j.is_discarded()) continue;
-                            if (j.value("ts", std::string()) > ts) {
+                            if (!j.is_object() || !j.contains("ts") || !j["ts"].is_string()) continue;
+                            const auto& t = j["ts"].get_ref<const std::string&>();
+                            if (t > ts || (inclusive && t == ts)) {
                                 out.push_back(j);
                                 if (limit && out.size() >= limit) break;
                             }
@@ -0,0 +1,201 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "marshal_state.hpp"
+
+// -------- index maintenance (${data_dir}/mrd/index.jsonl) --------
+
+inline std::filesystem::path index_path(const MarshalState& s) {
+    return std::filesystem::path(s.data_dir) / "mrd" / "index.jsonl";
+}
+
+// Calls fn(entry) for every line of the index that parses to an object,
+// among the lines starting before byte `end`.
+inline void for_each_index_entry(const std::filesystem::path& index,
+                                 const std::function<void(const nlohmann::json&)>& fn,
+                                 uint64_t end = UINT64_MAX) {
+    std::ifstream f(index);
+    std::string line;
+    for (uint64_t pos = 0; pos < end && f && std::getline(f, line);) {
+        pos += line.size() + 1;
+        if (line.empty()) continue;
+        auto j = nlohmann::json::parse(line, nullptr, false);
+        if (j.is_object()) fn(j);
+    }
+}
+
+// The same, newest line first, until fn returns false. The file is read
+// backwards in blocks, so stopping early costs only the lines visited.
+inline void for_each_index_entry_reverse(const std::filesystem::path& index,
+                                         const std::function<bool(const nlohmann::json&)>& fn,
+                                         uint64_t end = UINT64_MAX) {
+    constexpr uint64_t kBlock = 64 * 1024;
+    std::ifstream f(index, std::ios::binary | std::ios::ate);
+    if (!f) return;
+    uint64_t pos = std::min<uint64_t>(end, static_cast<uint64_t>(f.tellg()));
+    auto visit = [&](std::string_view line) {
+        if (line.empty()) return true;
+        auto j = nlohmann::json::parse(line, nullptr, false);
+        return !j.is_object() || fn(j);
+    };
+    std::string rest;  // read but not visited yet: the start of a line, then whole lines
+    while (pos > 0) {
+        const uint64_t n = std::min(pos, kBlock);
+        pos -= n;
+        std::string block(n, '\0');
+        f.seekg(static_cast<std::streamoff>(pos));
+        if (!f.read(block.data(), static_cast<std::streamsize>(n))) return;
+        rest.insert(0, block);
+        for (auto nl = rest.rfind('\n'); nl != std::string::npos; nl = rest.rfind('\n')) {
+            if (!visit(std::string_view(rest).substr(nl + 1))) return;
+            rest.resize(nl);
+        }
+    }
+    visit(rest);
+}
+
+// Entry fields as the index maintenance reads them. A field of the wrong type
+// (a hand-edited or foreign line) reads as absent rather than throwing.
+inline const std::string* entry_str(const nlohmann::json& e, const char* key) {
+    auto it = e.find(key);
+    return it != e.end() && it->is_string() ? &it->get_ref<const std::string&>() : nullptr;
+}
+
+inline uint64_t entry_u64(const nlohmann::json& e, const char* key) {
+    auto it = e.find(key);
+    return it != e.end() && it->is_number_unsigned() ? it->get<uint64_t>() : 0;
+}
+
+// Rewrites the index keeping only entries for which keep(entry) is true and
+// returns the number of entries dropped. The scan runs without the lock; lines
+// appended meanwhile are carried over verbatim before the atomic rename, so
+// ingest only waits for the short tail copy. `swapped(kept)` runs under the
+// lock right after the rename, with one flag per scanned non-empty line.
+inline size_t rewrite_index(const std::filesystem::path& index, std::mutex& mtx,
+                            const std::function<bool(const nlohmann::json&)>& keep,
+                            const std::function<void(const std::vector<bool>&)>& swapped = {}) {
+    namespace fs = std::filesystem;
+    std::uintmax_t snap = 0;
+    {
+        std::scoped_lock lk(mtx);
+        std::error_code ec;
+        snap = fs::file_size(index, ec);
+        if (ec) return 0;
+    }
+
+    fs::path tmp = index;
+    tmp += ".compact";
+    size_t dropped = 0;
+    std::vector<bool> kept;
+    {
+        std::ifstream in(index, std::ios::binary);
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!in || !out) throw std::runtime_error("open index for compaction failed: " + index.string());
+        std::string line;
+        std::uintmax_t pos = 0;
+        while (pos < snap && std::getline(in, line)) {
+            pos += line.size() + 1;
+            if (line.empty()) continue;
+            auto j = nlohmann::json::parse(line, nullptr, false);
+            kept.push_back(!j.is_object() || keep(j));
+            if (kept.back()) out << line << '\n';
+            else ++dropped;
+        }
+        if (!out) throw std::runtime_error("write compacted index failed: " + tmp.string());
+    }
+
+    std::error_code ec;
+    if (!dropped) {
+        fs::remove(tmp, ec);
+        return 0;
+    }
+
+    std::scoped_lock lk(mtx);
+    {
+        std::ifstream in(index, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(snap));
+        std::ofstream out(tmp, std::ios::binary | std::ios::app);
+        std::string tail((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        out << tail;
+        if (!out) throw std::runtime_error("append index tail failed: " + tmp.string());
+    }
+    fs::rename(tmp, index, ec);
+    if (ec) throw std::runtime_error("rename compacted index failed: " + ec.message());
+    if (swapped) swapped(kept);
+    return dropped;
+}
+
+// -------- segment housekeeping --------
+
+// Trims preallocated slack a previous run left in its segments, using the
+// index to find where the last stored blob of each segment ends.
+inline void recover_segments(MarshalState& s) {
+    if (!s.segments) return;
+    std::unordered_map<std::string, uint64_t> ends;
+    for_each_index_entry(index_path(s), [&](const nlohmann::json& e) {
+        auto seg = entry_str(e, "segment");
+        if (!seg || e.contains("origin")) return;
+        auto end = entry_u64(e, "offset") + entry_u64(e, "length");
+        auto& v  = ends[*seg];
+        v = std::max(v, end);
+    });
+    s.segments->recover([&](const std::string& p) {
+        auto it = ends.find(p);
+        return it == ends.end() ? uint64_t{0} : it->second;
+    });
+}
+
+// -------- content-addressed blobs --------
+
+// Rebuilds the blob reference counts from the first `index_bytes` of the
+// index, then deletes blobs no entry refers to. Returns the number of files
+// swept. Entries written after that point were counted by CasStore::put(),
+// so the rebuild may run alongside ingest when given the index length
+// before ingest started.
+inline uint64_t rebuild_cas(MarshalState& s, uint64_t index_bytes = UINT64_MAX) {
+    if (!s.cas) return 0;
+    for_each_index_entry(index_path(s), [&](const nlohmann::json& e) {
+        uint64_t h;
+        auto hash = entry_str(e, "hash");
+        if (hash && !e.contains("origin") && CasStore::parse_hex(*hash, h))
+            s.cas->adopt(h, entry_u64(e, "size_bytes"));
+    }, index_bytes);
+    return s.cas->sweep();
+}
+
+// Drops the oldest sealed segments beyond state.segment_keep: their index
+// entries are removed first, then the files. Returns bytes reclaimed.
+inline uint64_t compact_segments(MarshalState& s) {
+    namespace fs = std::filesystem;
+    if (!s.segments || s.segment_keep == 0) return 0;
+    auto sealed = s.segments->sealed();
+    if (sealed.size() <= s.segment_keep) return 0;
+
+    std::unordered_set<std::string> victims;
+    for (size_t i = 0; i + s.segment_keep < sealed.size(); ++i) victims.insert(sealed[i].second.string());
+
+    rewrite_index(index_path(s), s.index_mtx, [&](const nlohmann::json& e) {
+        auto seg = entry_str(e, "segment");
+        return !(seg && victims.count(*seg));
+    }, [&](const std::vector<bool>& kept) { s.index_cache.retain(kept); });
+
+    uint64_t reclaimed = 0;
+    for (auto& v : victims) {
+        std::error_code ec;
+        auto sz = fs::file_size(v, ec);
+        if (fs::remove(v, ec) && !ec) reclaimed += sz;
+    }
+    return reclaimed;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// -------- in-memory index --------
+//
+// Mirrors mrd/index.jsonl, one row per non-empty line in file order, so
+// /v1/mrd/since and /v1/mrd/latest are answered without touching the file.
+// Rows keep the raw line and are concatenated into responses unparsed.
+//
+// At startup only the rows written after the newest snapshot are loaded up
+// front; the older prefix follows in the background (finish_loading). Until
+// then, queries whose answer could include unloaded rows report that they
+// cannot be answered here and the caller scans the file instead.
+//
+// Appends and retain() must happen under the index mutex together with the
+// matching file change; the cache has its own lock for readers.
+//
+// Rows are normally in ts order (ingest stamps them under the index mutex),
+// and then since() finds its first row by binary search. A row out of order,
+// e.g. replicated from a marshal with another clock, switches it to a linear
+// scan until a rewrite restores the order. Either way, only the matching row
+// pointers are copied under the lock; the response is built outside it.
+
+struct IndexRow {
+    std::string line;
+    uint32_t ts_pos{0};  // where the entry's "ts" value sits in line
+    uint32_t ts_len{0};  // 0 for lines without one, which queries skip
+
+    std::string_view ts() const { return std::string_view(line).substr(ts_pos, ts_len); }
+
+    // Locates `ts`, the entry's parsed "ts" value, in the line.
+    void set_ts(std::string_view ts) {
+        const std::string key = "\"ts\":\"" + std::string(ts) + '"';
+        const auto p = line.find(key);
+        ts_pos = p == std::string::npos ? 0 : static_cast<uint32_t>(p + 6);
+        ts_len = p == std::string::npos ? 0 : static_cast<uint32_t>(ts.size());
+    }
+};
+
+class IndexCache {
+public:
+    using RowPtr = std::shared_ptr<const IndexRow>;
+    using Rows   = std::vector<RowPtr>;
+
+private:
+    mutable std::mutex m_;
+    Rows rows_;
+    bool complete_{true};
+    bool sorted_{true};   // rows_ ts never decreases (rows without one read as "")
+    std::string floor_;   // while loading: no unloaded row has a ts above this
+    std::string latest_;  // contents of latest.json
+    uint64_t generation_{0};
+
+    static bool in_order(const Rows& rows, size_t from = 0) {
+        for (size_t i = std::max<size_t>(from, 1); i < rows.size(); ++i)
+            if (rows[i]->ts() < rows[i - 1]->ts()) return false;
+        return true;
+    }
+
+public:
+    // Starts a load: `tail` are the rows after the unloaded prefix.
+    void begin_loading(std::string floor, Rows tail, std::string latest) {
+        std::scoped_lock lk(m_);
+        rows_ = std::move(tail);
+        sorted_ = in_order(rows_);
+        complete_ = false;
+        floor_ = std::move(floor);
+        latest_ = std::move(latest);
+        ++generation_;
+    }
+
+    void finish_loading(Rows prefix) {
+        std::scoped_lock lk(m_);
+        prefix.insert(prefix.end(), std::make_move_iterator(rows_.begin()), std::make_move_iterator(rows_.end()));
+        rows_ = std::move(prefix);
+        sorted_ = in_order(rows_);
+        complete_ = true;
+        ++generation_;
+    }
+
+    void append(Rows rows, std::string latest) {
+        std::scoped_lock lk(m_);
+        const size_t from = rows_.empty() ? 0 : rows_.size() - 1;
+        rows_.insert(rows_.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+        sorted_ = sorted_ && in_order(rows_, from);
+        latest_ = std::move(latest);
+        ++generation_;
+    }
+
+    // Drops row i for every keep[i] == false (an index rewrite); rows past
+    // keep.size() were appended meanwhile and stay.
+    void retain(const std::vector<bool>& keep) {
+        std::scoped_lock lk(m_);
+        Rows out;
+        out.reserve(rows_.size());
+        for (size_t i = 0; i < rows_.size(); ++i)
+            if (i >= keep.size() || keep[i]) out.push_back(std::move(rows_[i]));
+        rows_ = std::move(out);
+        sorted_ = in_order(rows_);
+        ++generation_;
+    }
+
+    // JSON array of the entries with ts > `ts` (>= when inclusive) in index
+    // order, at most `limit` (0 = all). False when unloaded rows could qualify,
+    // which for an inclusive query includes rows at the floor itself.
+    bool since(const std::string& ts, size_t limit, std::string& out, bool inclusive = false) const {
+        auto match = [&](const RowPtr& r) { return r->ts_len && (inclusive ? r->ts() >= ts : r->ts() > ts); };
+        Rows hits;
+        {
+            std::scoped_lock lk(m_);
+            if (!complete_ && (inclusive ? ts <= floor_ : ts < floor_)) return false;
+            auto it = rows_.begin();
+            if (sorted_)
+                it = std::partition_point(rows_.begin(), rows_.end(), [&](const RowPtr& r) { return !match(r); });
+            for (; it != rows_.end() && !(limit && hits.size() >= limit); ++it)
+                if (match(*it)) hits.push_back(*it);
+        }
+        out = "[";
+        for (auto& r : hits) {
+            if (out.size() > 1) out += ',';
+            out += r->line;
+        }
+        out += ']';
+        return true;
+    }
+
+    std::string latest() const {
+        std::scoped_lock lk(m_);
+        return latest_;
+    }
+
+    // The rows (shared, not copied) and the generation they belong to.
+    std::pair<Rows, uint64_t> rows() const {
+        std::scoped_lock lk(m_);
+        return {rows_, generation_};
+    }
+
+    bool complete() const {
+        std::scoped_lock lk(m_);
+        return complete_;
+    }
+
+    size_t size() const {
+        std::scoped_lock lk(m_);
+        return rows_.size();
+    }
+
+    uint64_t generation() const {
+        std::scoped_lock lk(m_);
+        return generation_;
+    }
+};
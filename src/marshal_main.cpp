@@ -1,14 +1,71 @@
+#include <csignal>
 #include <iostream>
+#include <thread>
 #include <boost/asio.hpp>
 #include "marshal_http.hpp"
 #include "marshal_ws.hpp"
 #include "marshal_state.hpp"
+#include "marshal_index.hpp"
+#include "marshal_retention.hpp"
+#include "marshal_snapshot.hpp"
+#include "marshal_relay.hpp"
+
+// "90", "90s", "15m", "12h", "7d"
+static std::chrono::seconds parse_duration(const std::string &s)
+{
+    size_t n = 0;
+    auto v = std::stoull(s, &n);
+    switch (n < s.size() ? s[n] : 's')
+    {
+    case 'm': return std::chrono::minutes(v);
+    case 'h': return std::chrono::hours(v);
+    case 'd': return std::chrono::hours(24 * v);
+    default: return std::chrono::seconds(v);
+    }
+}
+
+// "1048576", "512M", "20G"
+static uint64_t parse_bytes(const std::string &s)
+{
+    size_t n = 0;
+    uint64_t v = std::stoull(s, &n);
+    switch (n < s.size() ? s[n] : ' ')
+    {
+    case 'K': case 'k': return v << 10;
+    case 'M': case 'm': return v << 20;
+    case 'G': case 'g': return v << 30;
+    case 'T': case 't': return v << 40;
+    default: return v;
+    }
+}
 
 int main(int argc, char **argv)
 {
     std::string http_bind = "0.0.0.0:8080";
     std::string ws_bind = "0.0.0.0:8090";
     std::string data_dir = "/data";
+    std::string storage = "files";
+    uint64_t segment_mb = 256;
+    size_t segment_keep = 0;
+    RetentionPolicy retention;
+    std::chrono::seconds snapshot_interval{60};
+    size_t ws_ring = 1024;
+    bool ws_log = false;
+    std::string shm_name;
+    uint64_t shm_slots = 256;
+    uint32_t shm_slot_kb = 64;
+    std::string trace_dump;
+    uint64_t trace_dump_every = 1;
+    size_t bulk_threads = 2;
+    size_t bulk_queue = 64;
+    double bulk_rate = 0;    // bulk requests per second per client IP (0 = unlimited)
+    double bulk_burst = 200;
+    double preview_hz = 10;
+    float preview_saturation = 32000.f;
+    uint32_t preview_points = 32;
+    size_t ws_max_queue = 4096;
+    RelayOptions relay_opt;
+    std::string upstream_topics;
     for (int i = 1; i < argc; ++i)
     {
         std::string a = argv[i];
@@ -18,23 +75,171 @@ int main(int argc, char **argv)
             ws_bind = argv[++i];
         else if (a == "--data" && i + 1 < argc)
             data_dir = argv[++i];
+        else if (a == "--storage" && i + 1 < argc)
+            storage = argv[++i];
+        else if (a == "--segment-mb" && i + 1 < argc)
+            segment_mb = std::stoull(argv[++i]);
+        else if (a == "--segment-keep" && i + 1 < argc)
+            segment_keep = std::stoull(argv[++i]);
+        else if (a == "--retain-age" && i + 1 < argc)
+            retention.max_age = parse_duration(argv[++i]);
+        else if (a == "--retain-bytes" && i + 1 < argc)
+            retention.max_bytes = parse_bytes(argv[++i]);
+        else if (a == "--retain-entries" && i + 1 < argc)
+            retention.max_entries = std::stoull(argv[++i]);
+        else if (a == "--retention-interval" && i + 1 < argc)
+            retention.interval = parse_duration(argv[++i]);
+        else if (a == "--snapshot-interval" && i + 1 < argc)
+            snapshot_interval = parse_duration(argv[++i]);
+        else if (a == "--ws-ring" && i + 1 < argc)
+            ws_ring = std::stoull(argv[++i]);
+        else if (a == "--ws-log")
+            ws_log = true;
+        else if (a == "--ws-max-queue" && i + 1 < argc)
+            ws_max_queue = std::stoull(argv[++i]);
+        else if (a == "--upstream" && i + 1 < argc)
+            relay_opt.ws_url = argv[++i];
+        else if (a == "--upstream-http" && i + 1 < argc)
+            relay_opt.http_url = argv[++i];
+        else if (a == "--upstream-topics" && i + 1 < argc)
+            upstream_topics = argv[++i];
+        else if (a == "--shm" && i + 1 < argc)
+            shm_name = argv[++i];
+        else if (a == "--shm-slots" && i + 1 < argc)
+            shm_slots = std::stoull(argv[++i]);
+        else if (a == "--shm-slot-kb" && i + 1 < argc)
+            shm_slot_kb = static_cast<uint32_t>(std::stoul(argv[++i]));
+        else if (a == "--trace-dump" && i + 1 < argc)
+            trace_dump = argv[++i];
+        else if (a == "--trace-dump-every" && i + 1 < argc)
+            trace_dump_every = std::max<uint64_t>(1, std::stoull(argv[++i]));
+        else if (a == "--bulk-threads" && i + 1 < argc)
+            bulk_threads = std::stoull(argv[++i]);
+        else if (a == "--bulk-queue" && i + 1 < argc)
+            bulk_queue = std::stoull(argv[++i]);
+        else if (a == "--bulk-rate" && i + 1 < argc)
+            bulk_rate = std::stod(argv[++i]);
+        else if (a == "--bulk-burst" && i + 1 < argc)
+            bulk_burst = std::stod(argv[++i]);
+        else if (a == "--preview-hz" && i + 1 < argc)
+            preview_hz = std::stod(argv[++i]);
+        else if (a == "--preview-saturation" && i + 1 < argc)
+            preview_saturation = std::stof(argv[++i]);
+        else if (a == "--preview-points" && i + 1 < argc)
+            preview_points = static_cast<uint32_t>(std::stoul(argv[++i]));
     }
     auto split = [](const std::string &s)
     { auto p=s.find(":"); return std::pair{s.substr(0,p), static_cast<unsigned short>(std::stoi(s.substr(p+1)))}; };
     auto [http_host, http_port] = split(http_bind);
     auto [ws_host, ws_port] = split(ws_bind);
+    for (size_t p = 0; p < upstream_topics.size();)
+    {
+        auto q = std::min(upstream_topics.find(',', p), upstream_topics.size());
+        if (q > p)
+            relay_opt.topics.push_back(upstream_topics.substr(p, q - p));
+        p = q + 1;
+    }
 
     boost::asio::io_context ioc{1};
     MarshalState state;
     state.io = &ioc;
+    state.data_dir = data_dir;
+    state.storage = storage;
+    state.segment_bytes = segment_mb << 20;
+    state.segment_keep = segment_keep;
+    state.retention = retention;
+    state.snapshot_interval = snapshot_interval;
+    state.ws_ring = ws_ring;
+    state.ws_log = ws_log;
+    state.trace_dump_every = trace_dump_every;
+    state.preview_hz = preview_hz;
+    state.preview_saturation = preview_saturation;
+    state.preview_points = preview_points;
+    state.ws_max_queue = ws_max_queue;
+    state.upstream = relay_opt.ws_url;
+    if (!relay_opt.ws_url.empty())
+        state.preview_hz = 0; // previews arrive from upstream along with the acquisitions
+    // ingest and index queries run on their own pool, off the io thread serving pose traffic
+    state.sched = std::make_unique<Scheduler>(bulk_threads, bulk_queue, bulk_rate, bulk_burst);
+    if (!trace_dump.empty())
+        state.trace_dump = std::make_unique<trace::ChromeTraceWriter>(trace_dump);
+    if (storage == "segments")
+    {
+        state.segments = std::make_unique<SegmentStore>(std::filesystem::path(data_dir) / "mrd" / "segments", state.segment_bytes);
+    }
+    else if (storage == "cas")
+    {
+        state.cas = std::make_unique<CasStore>(std::filesystem::path(data_dir) / "mrd" / "cas");
+    }
+    else if (storage != "files")
+    {
+        std::cerr << "unknown --storage " << storage << " (expected files|segments|cas)\n";
+        return 2;
+    }
+
+    // recent index entries are loaded before serving; older ones (from the last
+    // snapshot, or the whole index without one) and storage recovery follow in the background
+    auto index_load = begin_index_load(state);
+    std::jthread index_task([&state, index_load](std::stop_token st)
+                            { finish_index_load(state, index_load, st); });
+    std::jthread snapshot_task([&state](std::stop_token st)
+                               { run_index_snapshots(state, st); });
 
     boost::asio::ip::tcp::endpoint http_ep{boost::asio::ip::make_address(http_host), http_port};
     boost::asio::ip::tcp::endpoint ws_ep{boost::asio::ip::make_address(ws_host), ws_port};
 
     HttpServer http{ioc, http_ep, state};
     WsServer ws{ioc, ws_ep, state};
+    // pose updates and index commits are announced to subscribers (and relays)
+    state.publish = [&ioc, &ws](std::string frame)
+    { boost::asio::post(ioc, [&ws, f = std::move(frame)]() mutable { ws.broadcast(std::move(f)); }); };
+
+    // relay mode: republish an upstream marshal's topics and replicate its pose and index
+    std::unique_ptr<Relay> relay;
+    if (!relay_opt.ws_url.empty())
+    {
+        relay = std::make_unique<Relay>(ioc, state, ws, relay_opt);
+        relay->start();
+    }
+
+    // background retention: enforces --retain-* and --segment-keep at low priority
+    std::jthread retention_task([&state](std::stop_token st)
+                                { run_retention(state, st); });
 
-    std::cout << "marshal listening http=" << http_bind << " ws=" << ws_bind << "\n";
+    // shared-memory transport for co-located services: <name>.in carries frames
+    // from local producers, <name>.out mirrors every WebSocket broadcast
+    std::unique_ptr<shm::ShmQueue> shm_in;
+    std::jthread shm_task;
+    if (!shm_name.empty())
+    {
+        shm_in = std::make_unique<shm::ShmQueue>(shm::Region::create(shm_name + ".in", shm_slots, shm_slot_kb << 10));
+        state.shm_out = std::make_unique<shm::ShmBroadcast>(shm::Region::create(shm_name + ".out", shm_slots, shm_slot_kb << 10, ws.log().epoch()));
+        shm_task = std::jthread([&ioc, &ws, q = shm_in.get()](std::stop_token st)
+                                {
+            std::string frame;
+            while (!st.stop_requested()) {
+                if (q->pop(frame, std::chrono::milliseconds(100)))
+                    boost::asio::post(ioc, [&ws, f = std::move(frame), rx = trace::now_ns()]() mutable { ws.broadcast(std::move(f), rx); });
+            } });
+    }
+
+    std::cout << "marshal listening http=" << http_bind << " ws=" << ws_bind << " storage=" << storage
+              << (shm_name.empty() ? "" : " shm=" + shm_name)
+              << (relay_opt.ws_url.empty() ? "" : " upstream=" + relay_opt.ws_url) << "\n";
+    // stop cleanly so background tasks join and shm regions are unlinked
+    boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
+    signals.async_wait([&ioc](auto, int)
+                       { ioc.stop(); });
     ioc.run();
+    relay.reset();
+    state.sched.reset(); // finish running bulk requests while the state is intact
+    try
+    {
+        write_index_snapshot(state);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "marshal: index snapshot failed: " << e.what() << "\n";
+    }
     return 0;
 }
\ No newline at end of file
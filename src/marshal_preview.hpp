@@ -0,0 +1,195 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "common/base64.hpp"
+#include "common/preview.hpp"
+
+// -------- acquisition preview (mrd.preview) --------
+//
+// Producers that opt in send each acquisition's samples on a topic of their
+// own, next to its mrd.acq frame:
+//   {"topic":"mrd.samples","payload":{"idx": I, "channels": C, "n": N,
+//    "iq": base64(float32 re,im ... channel-major)}}
+// These frames only feed this stage: they are not logged, mirrored to shm or
+// sent to subscribers. Every acquisition is summarized (see
+// common/preview.hpp); at most `hz` times a second the latest summary is
+// published on the mrd.preview topic, together with how many acquisitions and
+// saturated samples the interval saw.
+//
+// A frame whose text starts with kFramePrefix is handed over unparsed
+// (offer()); anything else reaches observe() once the marshal has parsed it.
+// Both only queue: parsing, decoding and the kernels run on the stage's own
+// thread, which hands due previews to the sink. Acquisitions arriving while
+// kMaxQueued are waiting are skipped and counted. Channel and sample counts
+// are bounded by what an ISMRMRD acquisition header can carry; a job the
+// worker fails on is logged and counted in failed().
+
+class PreviewStage {
+public:
+    using Sink = std::function<void(nlohmann::json)>;
+
+private:
+    struct Job {
+        std::string frame;  // an offered frame, parsed into the fields below by the worker
+        std::string iq;     // base64
+        uint32_t channels{0};
+        uint32_t n{0};
+        nlohmann::json idx;
+    };
+    static constexpr size_t kMaxQueued = 64;
+    static constexpr uint32_t kMaxChannels = UINT16_MAX;  // AcquisitionHeader::active_channels
+    static constexpr uint32_t kMaxSamples = UINT16_MAX;   // AcquisitionHeader::number_of_samples
+
+    std::chrono::steady_clock::duration period_{};
+    float sat_;
+    uint32_t points_;
+    Sink sink_;
+
+    std::mutex m_;
+    std::condition_variable_any cv_;
+    std::deque<Job> queue_;
+    uint64_t skipped_{0};
+    std::atomic<uint64_t> failed_{0};
+
+    // worker thread only
+    std::chrono::steady_clock::time_point next_{};
+    uint64_t acqs_{0};
+    uint64_t saturated_{0};
+    std::string iq_;  // decode buffer
+
+    std::jthread worker_;  // last: stops before the members it uses go away
+
+public:
+    static constexpr std::string_view kFramePrefix = R"({"topic":"mrd.samples",)";
+
+    static bool is_samples(std::string_view text) { return text.starts_with(kFramePrefix); }
+
+    PreviewStage(double hz, float saturation, uint32_t points, Sink sink)
+        : sat_(saturation), points_(points), sink_(std::move(sink)) {
+        if (hz > 0)
+            period_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / hz));
+        if (enabled()) worker_ = std::jthread([this](std::stop_token st) { run(st); });
+    }
+
+    bool enabled() const { return period_.count() > 0; }
+    uint64_t failed() const { return failed_; }
+
+    // Queues one parsed mrd.samples payload; false when it is malformed or
+    // out of range or the worker is behind.
+    bool observe(const nlohmann::json& payload) {
+        Job job;
+        return enabled() && read_payload(payload, job) && enqueue(std::move(job));
+    }
+
+    // Queues the text of one mrd.samples frame, see is_samples(); false when
+    // the worker is behind. The worker drops it if it does not parse.
+    bool offer(std::string frame) {
+        Job job;
+        job.frame = std::move(frame);
+        return enabled() && enqueue(std::move(job));
+    }
+
+private:
+    bool enqueue(Job job) {
+        {
+            std::scoped_lock lk(m_);
+            if (queue_.size() >= kMaxQueued) {
+                ++skipped_;
+                return false;
+            }
+            queue_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    static bool read_payload(const nlohmann::json& p, Job& job) {
+        if (!p.is_object()) return false;
+        auto count = [&](const char* k, uint32_t max) {
+            auto v = p.find(k);
+            return v != p.end() && v->is_number_unsigned() && v->get<uint64_t>() <= max ? v->get<uint32_t>() : 0u;
+        };
+        job.channels = count("channels", kMaxChannels);
+        job.n = count("n", kMaxSamples);
+        auto iq = p.find("iq");
+        if (!job.channels || !job.n || iq == p.end() || !iq->is_string()) return false;
+        job.iq = iq->get<std::string>();
+        job.idx = p.value("idx", nlohmann::json());
+        return true;
+    }
+
+    void run(std::stop_token st) {
+        for (;;) {
+            Job job;
+            uint64_t skipped;
+            {
+                std::unique_lock lk(m_);
+                if (!cv_.wait(lk, st, [&] { return !queue_.empty(); })) return;
+                job = std::move(queue_.front());
+                queue_.pop_front();
+                skipped = skipped_;
+                skipped_ = 0;
+            }
+            try {
+                if (!job.frame.empty()) {
+                    auto j = nlohmann::json::parse(job.frame, nullptr, false);
+                    if (!j.is_object() || !j.contains("payload") || !read_payload(j["payload"], job)) {
+                        acqs_ += skipped;
+                        continue;
+                    }
+                }
+                if (auto frame = summarize(job, skipped)) sink_(std::move(*frame));
+            } catch (const std::exception& e) {
+                if (failed_++ == 0) std::cerr << "marshal: preview failed: " << e.what() << "\n";
+            }
+        }
+    }
+
+    // Returns a preview frame when one is due.
+    std::optional<nlohmann::json> summarize(const Job& job, uint64_t skipped) {
+        using nlohmann::json;
+        acqs_ += skipped;  // counted, not summarized
+        iq_.clear();
+        if (!base64::decode(job.iq, iq_) || iq_.size() % 8) return std::nullopt;
+        // C*N complex floats, checked without multiplying the client's counts
+        const size_t samples = iq_.size() / 8;
+        if (samples % job.channels || samples / job.channels != job.n) return std::nullopt;
+        // std::string storage is suitably aligned for float
+        auto coils = preview::summarize(reinterpret_cast<const float*>(iq_.data()), job.channels, job.n, sat_, points_);
+        ++acqs_;
+        for (auto& c : coils) saturated_ += c.saturated;
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next_) return std::nullopt;
+        next_ = now + period_;
+
+        json jc = json::array();
+        for (auto& c : coils)
+            jc.push_back({{"rms", c.rms}, {"peak", c.peak}, {"sat", c.saturated}, {"profile", c.profile}});
+        json frame{{"topic", "mrd.preview"},
+                   {"payload", {{"idx", job.idx},
+                                {"channels", job.channels},
+                                {"samples", job.n},
+                                {"isa", preview::dispatch().isa},
+                                {"acqs", acqs_},
+                                {"saturated", saturated_},
+                                {"coils", std::move(jc)}}}};
+        acqs_ = saturated_ = 0;
+        return frame;
+    }
+};
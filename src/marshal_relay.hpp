@@ -0,0 +1,277 @@
+#pragma once
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "client/http_client.hpp"
+#include "client/ws_client.hpp"
+#include "common/trace.hpp"
+#include "marshal_http.hpp"
+#include "marshal_index.hpp"
+#include "marshal_state.hpp"
+#include "marshal_ws.hpp"
+
+// -------- relay (marshal-to-marshal fan-out) --------
+//
+// With --upstream, this marshal subscribes to another marshal's topics over
+// one WebSocket and republishes every frame to its own subscribers under
+// local sequence numbers, so marshals can be chained into a fan-out tree.
+// After a reconnect the link resumes from the last upstream seq it applied.
+//
+// Two topics are replicated into local state as well: "pose" sets the pose
+// store (GET /v1/pose/current), and "mrd.index" entries are appended to the
+// local index (GET /v1/mrd/since, /latest) tagged with "origin"; committing
+// them republishes mrd.index for the next hop. With --upstream-http, the
+// current pose and any index entries newer than the last replicated one are
+// fetched on the first connect, when the upstream reports a gap, and after
+// the upstream restarted, which it tells by a new log epoch in ws.subscribed.
+// The catch-up includes entries at the newest replicated ts, so entries of
+// the same millisecond are not lost; the (ts, seq) pairs already replicated
+// at that ts are skipped. It is fetched in pages of kCatchUpPage entries,
+// each from the ts of the last entry of the one before, until a short page.
+//
+// Backpressure: frames are taken off the link only as fast as they are
+// republished, and the upstream queues a bounded number per subscriber
+// before it switches a slow one to replay from its log. All link and HTTP
+// callbacks run on the marshal's io thread; index appends run on their own
+// thread, in arrival order.
+
+struct RelayOptions {
+    std::string ws_url;               // upstream WebSocket, e.g. ws://hub:8090/
+    std::string http_url;             // upstream HTTP API for catch-up; empty = none
+    std::vector<std::string> topics;  // empty = all topics
+};
+
+class Relay {
+    static constexpr size_t kCatchUpPage = 1000;
+
+    MarshalState& state_;
+    WsServer& ws_;
+    RelayOptions opt_;
+    std::string origin_;
+    std::shared_ptr<client::WsClient> link_;
+    std::shared_ptr<client::HttpClient> http_;
+    boost::asio::thread_pool disk_{1};
+
+    // io thread only
+    uint64_t seen_{0};              // last upstream seq applied
+    std::string epoch_;             // upstream log epoch; seen_ is only valid within it
+    bool need_catch_up_{true};
+    bool catching_up_{false};       // live index entries are held until the catch-up lands
+    std::vector<nlohmann::json> held_;
+
+    std::mutex m_;                  // guards the two below (io thread and disk_)
+    std::string last_ts_;           // newest replicated entry, the catch-up cursor
+    std::set<uint64_t> at_last_ts_; // seqs of the replicated entries at last_ts_
+    std::set<std::pair<std::string, uint64_t>> caught_up_;  // (ts, seq) of the pages of the last catch-up
+
+public:
+    Relay(boost::asio::io_context& ioc, MarshalState& s, WsServer& ws, RelayOptions opt)
+        : state_(s), ws_(ws), opt_(std::move(opt)), origin_(opt_.http_url.empty() ? opt_.ws_url : opt_.http_url) {
+        if (!opt_.topics.empty())
+            for (const char* t : {"pose", "mrd.index"})
+                if (std::find(opt_.topics.begin(), opt_.topics.end(), t) == opt_.topics.end()) opt_.topics.push_back(t);
+        ensure_dir(index_path(s).parent_path());
+        for_each_index_entry_reverse(index_path(s), [&](const nlohmann::json& e) {
+            auto ts = entry_str(e, "ts");
+            if (!ts || !e.contains("origin")) return true;
+            if (*ts < last_ts_) return false;  // replicated entries arrive in ts order
+            advance(*ts, entry_u64(e, "seq"));
+            return true;
+        });
+        link_ = client::WsClient::create(ioc, client::parse_url(opt_.ws_url));
+        if (!opt_.http_url.empty()) http_ = client::HttpClient::create(ioc, client::parse_url(opt_.http_url));
+    }
+
+    ~Relay() {
+        link_->close();
+        if (http_) http_->shutdown();
+        disk_.join();
+    }
+
+    Relay(const Relay&) = delete;
+    Relay& operator=(const Relay&) = delete;
+
+    void start() {
+        link_->on_connect([this] { return std::vector<std::string>{subscribe_request()}; });
+        link_->on_status([this](bool up, boost::beast::error_code ec) {
+            state_.relay_stats.connected = up;
+            if (!up) {
+                std::cerr << "marshal: upstream " << opt_.ws_url << " lost: " << ec.message() << "\n";
+                return;
+            }
+            ++state_.relay_stats.connects;
+            std::cout << "marshal: relaying " << opt_.ws_url << " from seq " << seen_ + 1 << std::endl;
+            if (need_catch_up_) catch_up();
+        });
+        link_->on_message([this](std::string text) { on_frame(text); });
+        link_->start();
+    }
+
+private:
+    std::string subscribe_request() const {
+        nlohmann::json sub{{"op", "subscribe"}, {"topics", opt_.topics}};
+        if (seen_) sub["from_seq"] = seen_ + 1;
+        return sub.dump();
+    }
+
+    void on_frame(const std::string& text) {
+        try {
+            apply_frame(text);
+        } catch (const std::exception& e) {
+            // a malformed upstream frame must not take down the io thread
+            std::cerr << "marshal: dropped upstream frame: " << e.what() << "\n";
+        }
+    }
+
+    void apply_frame(const std::string& text) {
+        auto j = nlohmann::json::parse(text, nullptr, false);
+        if (!j.is_object() || !j.contains("topic") || !j["topic"].is_string()) return;
+        const auto topic = j["topic"].get<std::string>();
+
+        if (topic == "ws.subscribed") {
+            // an upstream restarted without --ws-log numbers from 1 again under a new epoch
+            const auto& p = j["payload"];
+            const bool ok = p.is_object() && p.contains("head_seq") && p["head_seq"].is_number_unsigned();
+            const uint64_t head = ok ? p["head_seq"].get<uint64_t>() : seen_;
+            const std::string epoch = p.is_object() && p.contains("epoch") && p["epoch"].is_string() ? p["epoch"].get<std::string>() : epoch_;
+            const bool restarted = (!epoch_.empty() && epoch != epoch_) || head < seen_;
+            epoch_ = epoch;
+            if (restarted) {
+                std::cerr << "marshal: upstream restarted, resuming at its seq " << head + 1 << "\n";
+                seen_ = head;
+                link_->send(subscribe_request());
+                catch_up();
+            }
+            return;
+        }
+        if (topic == "ws.gap") {  // the upstream log no longer had frames we missed
+            ++state_.relay_stats.gaps;
+            catch_up();
+            return;
+        }
+        if (topic.rfind("ws.", 0) == 0) return;  // other link control frames stay on the link
+
+        if (const uint64_t seq = j.contains("seq") && j["seq"].is_number_unsigned() ? j["seq"].get<uint64_t>() : 0) {
+            if (seq <= seen_) return;  // replayed twice around a resubscribe
+            seen_ = seq;
+            state_.relay_stats.upstream_seq = seq;
+        }
+        ++state_.relay_stats.frames;
+
+        if (topic == "mrd.index") {
+            auto& p = j["payload"];
+            if (!p.is_object() || !p.contains("entries") || !p["entries"].is_array()) return;
+            auto& entries = p["entries"];
+            if (catching_up_) return held_.push_back(std::move(entries));
+            return post_entries(std::move(entries), false);  // republished by commit_entries
+        }
+        if (topic == "pose") {
+            Pose p;
+            if (pose_from_json(j["payload"], p)) state_.poses.set(p);
+        }
+        j.erase("seq");
+        ws_.publish(std::move(j), trace::now_ns());
+    }
+
+    // Fetches the upstream pose and the index entries after last_ts_.
+    void catch_up() {
+        need_catch_up_ = false;
+        if (!http_ || catching_up_) return;
+        catching_up_ = true;
+        ++state_.relay_stats.backfills;
+        namespace http = boost::beast::http;
+        http_->async_request(http_->make(http::verb::get, "/v1/pose/current"),
+                             [this](boost::beast::error_code ec, client::Response res) {
+                                 if (ec || res.result() != http::status::ok) return;
+                                 auto j = nlohmann::json::parse(res.body(), nullptr, false);
+                                 Pose p;
+                                 if (j.is_object() && pose_from_json(j["pose"], p)) state_.poses.set(p);
+                             });
+        std::string from;
+        {
+            std::scoped_lock lk(m_);
+            from = last_ts_;
+        }
+        fetch_page(std::move(from), kCatchUpPage, true);
+    }
+
+    // Requests up to `limit` upstream index entries at or after `from`
+    // (inclusive: same-ms entries may be missing) and then the next page, until
+    // a short page ends the catch-up and releases the held live entries.
+    void fetch_page(std::string from, size_t limit, bool first) {
+        namespace http = boost::beast::http;
+        const std::string query = (from.empty() ? "ts=0" : "from=" + from) + "&limit=" + std::to_string(limit);
+        http_->async_request(http_->make(http::verb::get, "/v1/mrd/since?" + query),
+                             [this, from, limit, first](boost::beast::error_code ec, client::Response res) {
+                                 auto entries = nlohmann::json::array();
+                                 if (!ec && res.result() == http::status::ok)
+                                     entries = nlohmann::json::parse(res.body(), nullptr, false);
+                                 else
+                                     std::cerr << "marshal: upstream index catch-up failed: "
+                                               << (ec ? ec.message() : std::to_string(res.result_int())) << "\n";
+                                 if (!entries.is_array()) entries = nlohmann::json::array();
+                                 std::string next = from;
+                                 if (!entries.empty() && entries.back().is_object())
+                                     if (auto ts = entry_str(entries.back(), "ts")) next = std::max(next, *ts);
+                                 const bool full = entries.size() >= limit;
+                                 post_entries(std::move(entries), true, first);
+                                 // a full page that did not get past `from` is all one ts: widen it
+                                 if (full) return fetch_page(next, next == from ? limit * 2 : kCatchUpPage, false);
+                                 for (auto& h : held_) post_entries(std::move(h), false);
+                                 held_.clear();
+                                 catching_up_ = false;
+                             });
+    }
+
+    // Moves the catch-up cursor to a replicated entry. Caller holds m_
+    // (or is the constructor).
+    void advance(const std::string& ts, uint64_t seq) {
+        if (ts > last_ts_) {
+            last_ts_ = ts;
+            at_last_ts_.clear();
+        }
+        if (ts == last_ts_) at_last_ts_.insert(seq);
+    }
+
+    // Appends replicated entries to the local index on disk_. Entries held
+    // during a catch-up may repeat ones it returned, and each catch-up page
+    // repeats the entries at last_ts_; those are skipped. `first` marks the
+    // first page of a catch-up.
+    void post_entries(nlohmann::json entries, bool catch_up, bool first = false) {
+        boost::asio::post(disk_, [this, entries = std::move(entries), catch_up, first]() mutable {
+            auto out = nlohmann::json::array();
+            {
+                std::scoped_lock lk(m_);
+                if (first) caught_up_.clear();
+                for (auto& e : entries) {
+                    if (!e.is_object()) continue;
+                    auto ts = entry_str(e, "ts");
+                    std::pair<std::string, uint64_t> key{ts ? *ts : std::string(), entry_u64(e, "seq")};
+                    if (catch_up) caught_up_.insert(key);
+                    else if (caught_up_.count(key)) continue;
+                    if (key.first == last_ts_ && at_last_ts_.count(key.second)) continue;
+                    if (!e.contains("origin")) e["origin"] = origin_;
+                    advance(key.first, key.second);
+                    out.push_back(std::move(e));
+                }
+            }
+            if (out.empty()) return;
+            try {
+                commit_entries(state_, out);
+                state_.relay_stats.index_entries += out.size();
+            } catch (const std::exception& e) {
+                std::cerr << "marshal: replicating index entries failed: " << e.what() << "\n";
+            }
+        });
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "marshal_state.hpp"
+#include "marshal_index.hpp"
+#include "marshal_time.hpp"
+#include "marshal_snapshot.hpp"
+
+// -------- retention --------
+//
+// Enforces state.retention (age, total bytes, entry count) on mrd/index.jsonl
+// and the blobs it references. Every limit selects the oldest entries, so a
+// pass drops a prefix of the index: the index is rewritten first (atomically,
+// see rewrite_index), then the unreferenced blobs and segments are deleted.
+// Content-addressed blobs are shared, so a dropped entry only releases its
+// reference and the blob goes with the last one. Entries replicated from an
+// upstream marshal ("origin") are dropped without touching any file. Only
+// bytes a drop can free count toward max_bytes: nothing for replicated
+// entries, and a shared blob once, at its newest entry. The
+// age limit stops at the first entry without a timestamp it can read, rather
+// than treating it as infinitely old.
+
+struct RetentionResult {
+    uint64_t entries{0};
+    uint64_t bytes{0};
+};
+
+// Lowers the calling thread's CPU and I/O priority so passes yield to ingest.
+inline void lower_thread_priority() {
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+#ifdef SYS_ioprio_set
+    constexpr int who_process = 1, class_idle = 3, class_shift = 13;
+    ::syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift);
+#endif
+}
+
+inline RetentionResult apply_retention(MarshalState& s) {
+    namespace fs = std::filesystem;
+    using nlohmann::json;
+    const auto& pol = s.retention;
+    auto& st        = s.retention_stats;
+    const auto index = index_path(s);
+    if (!pol.limited()) return {};
+
+    // segments sealed before the scan cannot gain new entries, so they can be
+    // deleted once no kept entry references them
+    std::unordered_set<std::string> sealed;
+    if (s.segments)
+        for (auto& seg : s.segments->sealed()) sealed.insert(seg.second.string());
+
+    struct Row { std::string ts; uint64_t bytes; };
+    std::vector<Row> rows;
+    std::unordered_map<std::string, size_t> newest;  // cas hash -> row of its newest reference
+    uint64_t total_bytes = 0;
+    st.scanned = 0;
+    for_each_index_entry(index, [&](const json& e) {
+        auto ts = entry_str(e, "ts");
+        rows.push_back({ts && is_iso8601(*ts) ? *ts : std::string(), 0});
+        if (e.contains("origin")) return;  // no local blob
+        const uint64_t b = entry_u64(e, "size_bytes");
+        if (auto hash = entry_str(e, "hash")) {
+            auto [it, fresh] = newest.try_emplace(*hash, rows.size() - 1);
+            if (!fresh) rows[it->second].bytes = 0;  // freed only with the newer reference
+            it->second = rows.size() - 1;
+        } else if (!entry_str(e, "segment") && !entry_str(e, "path")) {
+            return;
+        }
+        rows.back().bytes = b;
+    });
+    for (auto& r : rows) total_bytes += r.bytes;
+    st.total = rows.size();
+
+    size_t cut = 0;
+    if (pol.max_entries && rows.size() > pol.max_entries) cut = rows.size() - pol.max_entries;
+    if (pol.max_bytes) {
+        size_t k = 0;
+        for (uint64_t b = total_bytes; k < rows.size() && b > pol.max_bytes; ++k) b -= rows[k].bytes;
+        cut = std::max(cut, k);
+    }
+    if (pol.max_age.count()) {
+        const auto cutoff = iso8601_ms(std::chrono::system_clock::now() - pol.max_age);
+        size_t k = 0;
+        while (k < rows.size() && !rows[k].ts.empty() && rows[k].ts < cutoff) ++k;
+        cut = std::max(cut, k);
+    }
+    st.scanned = rows.size();
+    if (cut == 0) return {};
+
+    std::vector<std::string> files;
+    std::vector<uint64_t> released, unreferenced;
+    std::unordered_set<std::string> seg_dropped, seg_kept;
+    size_t i = 0;
+    RetentionResult r;
+    r.entries = rewrite_index(index, s.index_mtx, [&](const json& e) {
+        const bool keep = i++ >= cut;
+        st.scanned = i;
+        uint64_t h;
+        if (e.contains("origin")) return keep;  // replicated from an upstream marshal; its blobs are not ours
+        auto seg = entry_str(e, "segment"), hash = entry_str(e, "hash"), path = entry_str(e, "path");
+        if (seg) (keep ? seg_kept : seg_dropped).insert(*seg);
+        else if (hash) {
+            // without a cas store (storage changed) shared blobs are left alone
+            if (!keep && s.cas && CasStore::parse_hex(*hash, h)) released.push_back(h);
+        }
+        else if (!keep && path) files.push_back(*path);
+        return keep;
+    }, [&](const std::vector<bool>& kept) {
+        // references drop only once the rewritten index is in place
+        s.index_cache.retain(kept);
+        for (auto h : released)
+            if (s.cas->release(h)) unreferenced.push_back(h);
+    });
+
+    for (auto& f : files) {
+        std::error_code ec;
+        auto sz = fs::file_size(f, ec);
+        if (fs::remove(f, ec) && !ec) r.bytes += sz;
+    }
+    for (auto h : unreferenced) r.bytes += s.cas->reap(h);
+    for (auto& seg : seg_dropped) {
+        if (seg_kept.count(seg) || !sealed.count(seg)) continue;
+        std::error_code ec;
+        auto sz = fs::file_size(seg, ec);
+        if (fs::remove(seg, ec) && !ec) r.bytes += sz;
+    }
+    return r;
+}
+
+// Body of the background retention thread: one pass every policy.interval,
+// starting once the index is loaded; none at all without a limit. A pass that rewrote the index is
+// followed by a fresh snapshot, as the rewrite invalidates the previous one.
+inline void run_retention(MarshalState& s, std::stop_token st) {
+    lower_thread_priority();
+    auto& stats = s.retention_stats;
+    while (!st.stop_requested() && !s.index_stats.loaded)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    while (!st.stop_requested()) {
+        if (!s.retention.limited() && s.segment_keep == 0) return;  // nothing to enforce
+        stats.running = true;
+        auto t0 = std::chrono::steady_clock::now();
+        try {
+            auto r = apply_retention(s);
+            r.bytes += compact_segments(s);
+            stats.entries_removed += r.entries;
+            stats.bytes_reclaimed += r.bytes;
+            if (r.entries || r.bytes)
+                std::cout << "marshal: retention removed " << r.entries << " entries, reclaimed "
+                          << r.bytes << " bytes" << std::endl;
+            if (r.entries || r.bytes) write_index_snapshot(s);
+        } catch (const std::exception& e) {
+            std::cerr << "marshal: retention pass failed: " << e.what() << "\n";
+        }
+        stats.last_pass_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - t0).count();
+        ++stats.passes;
+        stats.running = false;
+
+        auto until = std::chrono::steady_clock::now() + s.retention.interval;
+        while (!st.stop_requested() && std::chrono::steady_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
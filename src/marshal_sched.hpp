@@ -0,0 +1,159 @@
+#pragma once
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <nlohmann/json.hpp>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// -------- request scheduling --------
+//
+// Routes are either latency-critical (pose, health, config, stats) or bulk
+// (ingest and index queries). Critical requests are handled inline on the
+// network io_context, which therefore never runs blob writes or index scans.
+// Bulk requests are admitted per client by a token bucket (429 when empty)
+// and run on a bounded thread pool (503 when its queue is full). Admission is
+// decided from the request header, before a large body is read.
+
+enum class RouteClass { Critical, Bulk };
+
+inline RouteClass classify(std::string_view target) {
+    auto starts = [&](std::string_view p) { return target.substr(0, p.size()) == p; };
+    if (starts("/v1/mrd/")) return RouteClass::Bulk;
+    return RouteClass::Critical;
+}
+
+// Refills `rate` tokens per second up to `burst`.
+class TokenBucket {
+    double tokens_;
+    std::chrono::steady_clock::time_point last_;
+
+public:
+    explicit TokenBucket(double burst) : tokens_(burst), last_(std::chrono::steady_clock::now()) {}
+
+    void refill(double rate, double burst, std::chrono::steady_clock::time_point now) {
+        tokens_ = std::min(burst, tokens_ + rate * std::chrono::duration<double>(now - last_).count());
+        last_   = now;
+    }
+
+    bool take(double rate, double burst, std::chrono::steady_clock::time_point now) {
+        refill(rate, burst, now);
+        if (tokens_ < 1.0) return false;
+        tokens_ -= 1.0;
+        return true;
+    }
+
+    bool full(double burst) const { return tokens_ >= burst; }
+};
+
+struct SchedStats {
+    std::atomic<uint64_t> critical{0};
+    std::atomic<uint64_t> bulk{0};
+    std::atomic<uint64_t> rejected_rate{0};   // 429
+    std::atomic<uint64_t> rejected_queue{0};  // 503
+    std::atomic<uint64_t> failed{0};          // bulk requests that threw (500)
+    std::atomic<size_t>   bulk_pending{0};    // queued or running
+};
+
+class Scheduler {
+    boost::asio::thread_pool pool_;
+    size_t threads_;
+    size_t max_pending_;
+    double rate_;   // bulk requests per second per client, 0 = unlimited
+    double burst_;
+
+    std::mutex m_;
+    std::unordered_map<std::string, TokenBucket> buckets_;
+    std::chrono::steady_clock::time_point last_sweep_{std::chrono::steady_clock::now()};
+
+public:
+    SchedStats stats;
+
+    Scheduler(size_t threads, size_t max_pending, double rate, double burst)
+        : pool_(std::max<size_t>(threads, 1)), threads_(std::max<size_t>(threads, 1)),
+          max_pending_(std::max<size_t>(max_pending, 1)), rate_(rate), burst_(std::max(burst, 1.0)) {}
+
+    ~Scheduler() { pool_.join(); }
+
+    // Token-bucket check for one bulk request from `client`.
+    bool admit(const std::string& client) {
+        if (rate_ <= 0) return true;
+        const auto now = std::chrono::steady_clock::now();
+        std::scoped_lock lk(m_);
+        // forget clients whose bucket refilled completely
+        if (now - last_sweep_ > std::chrono::seconds(60)) {
+            last_sweep_ = now;
+            for (auto it = buckets_.begin(); it != buckets_.end();) {
+                it->second.refill(rate_, burst_, now);
+                it = it->second.full(burst_) ? buckets_.erase(it) : std::next(it);
+            }
+        }
+        auto it = buckets_.try_emplace(client, burst_).first;
+        if (it->second.take(rate_, burst_, now)) return true;
+        ++stats.rejected_rate;
+        return false;
+    }
+
+    // Header-time check that the pool can take one more request.
+    bool accepting() {
+        if (stats.bulk_pending.load() < max_pending_) return true;
+        ++stats.rejected_queue;
+        return false;
+    }
+
+    // Queues fn on the bulk pool; false (503) when max_pending is reached.
+    // An exception from fn is logged and passed to on_error, which answers
+    // the request it belongs to.
+    bool submit(std::function<void()> fn, std::function<void(const std::string&)> on_error = {}) {
+        if (stats.bulk_pending.fetch_add(1) >= max_pending_) {
+            --stats.bulk_pending;
+            ++stats.rejected_queue;
+            return false;
+        }
+        ++stats.bulk;
+        boost::asio::post(pool_, [this, fn = std::move(fn), on_error = std::move(on_error)] {
+            // bulk workers run niced so the io thread preempts them on busy cores
+            static thread_local const bool niced =
+                ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 10) == 0;
+            (void)niced;
+            auto fail = [&](const std::string& what) {
+                ++stats.failed;
+                std::cerr << "marshal: bulk request failed: " << what << "\n";
+                if (!on_error) return;
+                try { on_error(what); } catch (const std::exception& e) {
+                    std::cerr << "marshal: bulk error response failed: " << e.what() << "\n";
+                }
+            };
+            try { fn(); }
+            catch (const std::exception& e) { fail(e.what()); }
+            catch (...) { fail("unknown exception"); }
+            --stats.bulk_pending;
+        });
+        return true;
+    }
+
+    nlohmann::json to_json() const {
+        return {{"bulk_threads", threads_},
+                {"bulk_queue", max_pending_},
+                {"bulk_rate", rate_},
+                {"bulk_burst", burst_},
+                {"critical", stats.critical.load()},
+                {"bulk", stats.bulk.load()},
+                {"bulk_pending", stats.bulk_pending.load()},
+                {"rejected_429", stats.rejected_rate.load()},
+                {"rejected_503", stats.rejected_queue.load()},
+                {"failed_500", stats.failed.load()}};
+    }
+};
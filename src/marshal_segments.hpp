@@ -0,0 +1,171 @@
+#pragma once
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// -------- segment-file storage --------
+//
+// Packs many small MRD blobs into large preallocated files under
+// ${data_dir}/mrd/segments/seg_NNNNNN.seg. Each blob is addressed by
+// (segment, offset, length); the index records that triple instead of a
+// per-blob path. A segment is sealed (truncated to its used length) once the
+// next blob no longer fits, and a fresh one is preallocated.
+
+struct SegmentRef {
+    std::string segment;   // full path of the segment file
+    uint64_t    offset{0};
+    uint64_t    length{0};
+};
+
+class SegmentStore {
+    std::filesystem::path root_;
+    uint64_t segment_bytes_;
+    std::mutex m_;
+    int      fd_{-1};
+    uint64_t id_{0};       // id of the active segment
+    uint64_t used_{0};     // bytes written into the active segment
+    uint64_t capacity_{0}; // preallocated size of the active segment
+    uint64_t opened_id_{0}; // newest segment left by a previous run
+
+public:
+    SegmentStore(std::filesystem::path root, uint64_t segment_bytes)
+        : root_(std::move(root)), segment_bytes_(segment_bytes ? segment_bytes : (64ull << 20)) {
+        std::error_code ec;
+        std::filesystem::create_directories(root_, ec);
+        if (ec) throw std::runtime_error("create segment dir failed: " + ec.message());
+        for (auto& s : list()) id_ = std::max(id_, s.first);
+        opened_id_ = id_;
+    }
+
+    ~SegmentStore() {
+        std::scoped_lock lk(m_);
+        seal_locked();
+    }
+
+    SegmentStore(const SegmentStore&) = delete;
+    SegmentStore& operator=(const SegmentStore&) = delete;
+
+    static std::string name_for(uint64_t id) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "seg_%06llu.seg", static_cast<unsigned long long>(id));
+        return buf;
+    }
+
+    // parses "seg_000042.seg" -> 42; 0 when the name is not a segment
+    static uint64_t id_from(const std::filesystem::path& p) {
+        auto n = p.filename().string();
+        if (n.size() < 9 || n.rfind("seg_", 0) != 0 || p.extension() != ".seg") return 0;
+        try { return std::stoull(n.substr(4, n.size() - 8)); } catch (...) { return 0; }
+    }
+
+    const std::filesystem::path& root() const { return root_; }
+
+    // all segment files on disk, oldest first
+    std::vector<std::pair<uint64_t, std::filesystem::path>> list() const {
+        std::vector<std::pair<uint64_t, std::filesystem::path>> out;
+        std::error_code ec;
+        for (auto& de : std::filesystem::directory_iterator(root_, ec)) {
+            if (auto id = id_from(de.path())) out.emplace_back(id, de.path());
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    // segments that no longer receive appends, oldest first
+    std::vector<std::pair<uint64_t, std::filesystem::path>> sealed() {
+        uint64_t active;
+        { std::scoped_lock lk(m_); active = fd_ >= 0 ? id_ : 0; }
+        auto all = list();
+        all.erase(std::remove_if(all.begin(), all.end(),
+                                 [&](auto& s) { return s.first == active; }),
+                  all.end());
+        return all;
+    }
+
+    // Trims preallocated slack left behind by a previous run. `used_end(path)`
+    // returns the end of the last indexed blob in that segment. Segments this
+    // run created are left alone, so recovery may run alongside ingest.
+    template <class UsedEnd>
+    void recover(UsedEnd&& used_end) {
+        std::scoped_lock lk(m_);
+        for (auto& [id, p] : list()) {
+            if (id > opened_id_) continue;
+            std::error_code ec;
+            auto sz  = std::filesystem::file_size(p, ec);
+            if (ec) continue;
+            uint64_t end = used_end(p.string());
+            if (end < sz) std::filesystem::resize_file(p, end, ec);
+        }
+    }
+
+    // Appends one blob; thread-safe.
+    SegmentRef append(const void* data, size_t n) {
+        std::scoped_lock lk(m_);
+        if (fd_ < 0 || used_ + n > capacity_) roll_locked(n);
+        write_at(data, n, used_);
+        SegmentRef ref{(root_ / name_for(id_)).string(), used_, n};
+        used_ += n;
+        return ref;
+    }
+
+    // Appends several blobs back to back under one lock; thread-safe.
+    std::vector<SegmentRef> append_many(const std::vector<std::pair<const char*, size_t>>& blobs) {
+        std::vector<SegmentRef> out;
+        out.reserve(blobs.size());
+        std::scoped_lock lk(m_);
+        for (auto& [data, n] : blobs) {
+            if (fd_ < 0 || used_ + n > capacity_) roll_locked(n);
+            write_at(data, n, used_);
+            out.push_back({(root_ / name_for(id_)).string(), used_, n});
+            used_ += n;
+        }
+        return out;
+    }
+
+private:
+    void write_at(const void* data, size_t n, uint64_t off) {
+        auto p = static_cast<const char*>(data);
+        while (n) {
+            ssize_t w = ::pwrite(fd_, p, n, static_cast<off_t>(off));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("segment write failed: " + std::system_category().message(errno));
+            }
+            p += w; n -= static_cast<size_t>(w); off += static_cast<uint64_t>(w);
+        }
+    }
+
+    void seal_locked() {
+        if (fd_ < 0) return;
+        if (::ftruncate(fd_, static_cast<off_t>(used_)) != 0) { /* keep slack; recover() trims it */ }
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    void roll_locked(size_t need) {
+        seal_locked();
+        ++id_;
+        used_     = 0;
+        capacity_ = std::max<uint64_t>(segment_bytes_, need);
+        auto path = root_ / name_for(id_);
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw std::runtime_error("open segment failed: " + path.string());
+        int rc = ::posix_fallocate(fd_, 0, static_cast<off_t>(capacity_));
+        if (rc != 0 && rc != EOPNOTSUPP && rc != EINVAL) {
+            ::close(fd_);
+            fd_ = -1;
+            throw std::runtime_error("preallocate segment failed: " + std::system_category().message(rc));
+        }
+    }
+};
@@ -0,0 +1,316 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "marshal_index.hpp"
+#include "marshal_state.hpp"
+
+// -------- index snapshots (${data_dir}/mrd/index.snap) --------
+//
+// A snapshot records, for every index line, where its "ts" value sits, plus
+// the length and inode of the index.jsonl it was taken from. That is all the
+// in-memory index (marshal_index_cache.hpp) needs besides the lines, which
+// are read back from the index itself without parsing any JSON.
+//
+// Startup parses only the lines appended after the snapshot and starts
+// serving; the older lines are loaded in the background. Without a snapshot
+// that matches the index, the whole index is parsed there instead, and
+// /v1/mrd/since falls back to scanning the file until it is done.
+//
+// Snapshots are written every state.snapshot_interval if the index changed,
+// after a retention pass rewrote the index (which invalidates the previous
+// one), and at shutdown.
+//
+// The index "seq" counter resumes above every locally ingested entry: from
+// the snapshot and the tail, or, without a usable snapshot, from the newest
+// local entry, found by reading the index backwards. The background load
+// raises it further should the index be out of order.
+//
+// Layout, integers little-endian: "MRDSNAP2", u64 index bytes, u64 index
+// inode, u64 rows, u64 index seq, str newest ts, str last line, then u32 ts
+// position and u32 ts length per row; str is a u32 length followed by the
+// bytes.
+
+namespace snapshot_detail {
+
+constexpr char kMagic[8] = {'M', 'R', 'D', 'S', 'N', 'A', 'P', '2'};
+
+struct Header {
+    uint64_t index_bytes{0};
+    uint64_t index_inode{0};
+    uint64_t rows{0};
+    uint64_t index_seq{0};  // no local entry of the snapshot has a larger seq
+    std::string max_ts;     // no snapshot row has a later ts
+    std::string last_line;  // the index line ending at index_bytes
+};
+
+inline void put_u32(std::ostream& o, uint32_t v) { o.write(reinterpret_cast<const char*>(&v), 4); }
+
+inline void put_u64(std::ostream& o, uint64_t v) { o.write(reinterpret_cast<const char*>(&v), 8); }
+
+inline void put_str(std::ostream& o, const std::string& s) {
+    put_u32(o, static_cast<uint32_t>(s.size()));
+    o.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+inline bool get_u32(std::istream& in, uint32_t& v) { return bool(in.read(reinterpret_cast<char*>(&v), 4)); }
+
+inline bool get_u64(std::istream& in, uint64_t& v) { return bool(in.read(reinterpret_cast<char*>(&v), 8)); }
+
+inline bool get_str(std::istream& in, std::string& s) {
+    uint32_t n;
+    if (!get_u32(in, n)) return false;
+    s.resize(n);
+    return bool(in.read(s.data(), n));
+}
+
+inline bool read_header(std::istream& in, Header& h) {
+    char magic[8];
+    return in.read(magic, 8) && std::equal(magic, magic + 8, kMagic) && get_u64(in, h.index_bytes) &&
+           get_u64(in, h.index_inode) && get_u64(in, h.rows) && get_u64(in, h.index_seq) && get_str(in, h.max_ts) && get_str(in, h.last_line);
+}
+
+// Size and inode of the index; zeros when it does not exist yet.
+inline void stat_index(const std::filesystem::path& index, uint64_t& bytes, uint64_t& inode) {
+    struct stat st {};
+    bytes = inode = 0;
+    if (::stat(index.c_str(), &st) != 0) return;
+    bytes = static_cast<uint64_t>(st.st_size);
+    inode = static_cast<uint64_t>(st.st_ino);
+}
+
+// True when the index still starts with the lines the snapshot was taken from.
+inline bool matches(const std::filesystem::path& index, const Header& h, uint64_t bytes, uint64_t inode) {
+    if (h.index_inode != inode || h.index_bytes > bytes) return false;
+    if (h.rows == 0) return true;
+    const uint64_t n = h.last_line.size() + 1;
+    if (n > h.index_bytes) return false;
+    std::ifstream in(index, std::ios::binary);
+    std::string tail(n, '\0');
+    in.seekg(static_cast<std::streamoff>(h.index_bytes - n));
+    return in.read(tail.data(), static_cast<std::streamsize>(n)) && tail.back() == '\n' &&
+           tail.compare(0, n - 1, h.last_line) == 0;
+}
+
+} // namespace snapshot_detail
+
+inline std::filesystem::path snapshot_path(const MarshalState& s) {
+    return std::filesystem::path(s.data_dir) / "mrd" / "index.snap";
+}
+
+// One row per non-empty index line in [from, to). Stops early on request.
+// Raises *index_seq to the largest seq of a local entry among them.
+inline IndexCache::Rows read_index_rows(const std::filesystem::path& index, uint64_t from, uint64_t to,
+                                        std::stop_token stop = {}, uint64_t* index_seq = nullptr) {
+    IndexCache::Rows rows;
+    std::ifstream in(index, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(from));
+    std::string line;
+    for (uint64_t pos = from; pos < to && std::getline(in, line) && !stop.stop_requested();) {
+        pos += line.size() + 1;
+        if (line.empty()) continue;
+        auto row = std::make_shared<IndexRow>();
+        auto j = nlohmann::json::parse(line, nullptr, false);
+        row->line = std::move(line);
+        if (j.is_object() && j.contains("ts") && j["ts"].is_string()) row->set_ts(j["ts"].get<std::string>());
+        if (index_seq && j.is_object() && !j.contains("origin")) *index_seq = std::max(*index_seq, entry_u64(j, "seq"));
+        rows.push_back(std::move(row));
+    }
+    return rows;
+}
+
+// Writes a snapshot of the in-memory index unless it is still loading or
+// unchanged since the last one. Ingest only waits while the row list is
+// shared out; the file is written without the index lock.
+inline bool write_index_snapshot(MarshalState& s) {
+    namespace fs = std::filesystem;
+    using namespace snapshot_detail;
+    auto& st = s.index_stats;
+    if (!st.loaded) return false;
+    std::scoped_lock slk(s.snapshot_mtx);
+    const auto t0 = std::chrono::steady_clock::now();
+
+    Header h;
+    IndexCache::Rows rows;
+    uint64_t gen;
+    {
+        std::scoped_lock lk(s.index_mtx);
+        std::tie(rows, gen) = s.index_cache.rows();
+        if (gen == st.snapshot_generation) return false;
+        stat_index(index_path(s), h.index_bytes, h.index_inode);
+        h.index_seq = s.index_seq;
+    }
+    h.rows = rows.size();
+    std::string_view max_ts;
+    for (auto& r : rows) max_ts = std::max(max_ts, r->ts());
+    h.max_ts = max_ts;
+    if (!rows.empty()) h.last_line = rows.back()->line;
+
+    const auto path = snapshot_path(s);
+    fs::path tmp = path;
+    tmp += ".tmp";
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("open index snapshot failed: " + tmp.string());
+        out.write(kMagic, 8);
+        put_u64(out, h.index_bytes);
+        put_u64(out, h.index_inode);
+        put_u64(out, h.rows);
+        put_u64(out, h.index_seq);
+        put_str(out, h.max_ts);
+        put_str(out, h.last_line);
+        for (auto& r : rows) {
+            put_u32(out, r->ts_pos);
+            put_u32(out, r->ts_len);
+        }
+        if (!out.flush()) throw std::runtime_error("write index snapshot failed: " + tmp.string());
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) throw std::runtime_error("rename index snapshot failed: " + ec.message());
+
+    st.snapshot_generation = gen;
+    ++st.snapshots;
+    st.last_snapshot_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
+
+// What begin_index_load() left for finish_index_load().
+struct IndexLoad {
+    bool from_snapshot{false};
+    uint64_t prefix_bytes{0};  // index bytes not loaded yet
+    uint64_t index_bytes{0};   // index length before serving; ingest accounts for what follows
+};
+
+// Loads what must be in memory before serving: latest.json, the index lines
+// written after the newest matching snapshot and the index seq to resume at.
+inline IndexLoad begin_index_load(MarshalState& s) {
+    using namespace snapshot_detail;
+    auto& st = s.index_stats;
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto index = index_path(s);
+    st.loaded = false;
+
+    std::string latest;
+    {
+        std::ifstream f(index.parent_path() / "latest.json", std::ios::binary);
+        latest.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+
+    IndexLoad load;
+    std::scoped_lock lk(s.index_mtx);
+    uint64_t bytes, inode;
+    stat_index(index, bytes, inode);
+    Header h;
+    std::ifstream snap(snapshot_path(s), std::ios::binary);
+    if (snap && read_header(snap, h) && matches(index, h, bytes, inode)) {
+        s.index_seq = h.index_seq;
+        auto tail = read_index_rows(index, h.index_bytes, bytes, {}, &s.index_seq);
+        st.from_snapshot = true;
+        st.tail_rows = tail.size();
+        load = {true, h.index_bytes, bytes};
+        s.index_cache.begin_loading(h.max_ts, std::move(tail), std::move(latest));
+    } else {
+        load = {false, bytes, bytes};
+        s.index_seq = 0;
+        for_each_index_entry_reverse(index, [&](const nlohmann::json& e) {
+            if (e.contains("origin")) return true;
+            s.index_seq = entry_u64(e, "seq");  // local seqs are appended in order
+            return false;
+        }, bytes);
+        s.index_cache.begin_loading("\xff", {}, std::move(latest));  // every query scans the file meanwhile
+    }
+    st.startup_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - t0).count();
+    return load;
+}
+
+// Body of the background load: the rows before the tail, then the storage
+// recovery that needs the whole index. Retention and snapshots wait for it.
+inline void finish_index_load(MarshalState& s, IndexLoad load, std::stop_token stop) {
+    using namespace snapshot_detail;
+    auto& st = s.index_stats;
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto index = index_path(s);
+
+    IndexCache::Rows prefix;
+    bool ok = false;
+    if (load.from_snapshot) {
+        std::ifstream snap(snapshot_path(s), std::ios::binary);
+        std::ifstream in(index, std::ios::binary);
+        Header h;
+        ok = read_header(snap, h) && h.index_bytes == load.prefix_bytes;
+        prefix.reserve(ok ? std::min(h.rows, h.index_bytes / 2) : 0);
+        std::string line;
+        for (uint64_t pos = 0; ok && pos < h.index_bytes && std::getline(in, line) && !stop.stop_requested();) {
+            pos += line.size() + 1;
+            if (line.empty()) continue;
+            auto row = std::make_shared<IndexRow>();
+            ok = get_u32(snap, row->ts_pos) && get_u32(snap, row->ts_len) &&
+                 uint64_t{row->ts_pos} + row->ts_len <= line.size();
+            row->line = std::move(line);
+            prefix.push_back(std::move(row));
+        }
+        ok = ok && prefix.size() == h.rows;
+        if (!ok && !stop.stop_requested()) std::cerr << "marshal: index snapshot does not match, loading the index instead\n";
+    }
+    if (!ok) {
+        uint64_t seq = 0;
+        prefix = read_index_rows(index, 0, load.prefix_bytes, stop, &seq);
+        std::scoped_lock lk(s.index_mtx);
+        s.index_seq = std::max(s.index_seq, seq);  // a snapshot that does not match may undercount too
+    }
+    if (stop.stop_requested()) return;
+    st.from_snapshot = ok;
+    st.snapshot_rows = ok ? prefix.size() : 0;
+    s.index_cache.finish_loading(std::move(prefix));
+    if (ok && st.tail_rows == 0) st.snapshot_generation = s.index_cache.generation();  // still current
+
+    try {
+        recover_segments(s);
+        if (auto swept = rebuild_cas(s, load.index_bytes))
+            std::cout << "marshal: removed " << swept << " unreferenced cas files\n";
+    } catch (const std::exception& e) {
+        std::cerr << "marshal: storage recovery failed: " << e.what() << "\n";
+    }
+    st.backfill_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - t0).count();
+    st.loaded = true;
+    std::cout << "marshal: index loaded, " << s.index_cache.size() << " entries ("
+              << (ok ? "snapshot + " + std::to_string(st.tail_rows.load()) + " new" : std::string("full scan"))
+              << ", " << st.startup_ms.load() << " ms before serving, " << st.backfill_ms.load()
+              << " ms in background)" << std::endl;
+}
+
+// Body of the periodic snapshot thread.
+inline void run_index_snapshots(MarshalState& s, std::stop_token st) {
+    if (s.snapshot_interval.count() == 0) return;
+    while (!st.stop_requested()) {
+        auto until = std::chrono::steady_clock::now() + s.snapshot_interval;
+        while (!st.stop_requested() && std::chrono::steady_clock::now() < until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (st.stop_requested()) break;
+        try {
+            write_index_snapshot(s);
+        } catch (const std::exception& e) {
+            std::cerr << "marshal: index snapshot failed: " << e.what() << "\n";
+        }
+    }
+}
@@ -4,9 +4,17 @@
 #include <memory>
 #include <string>
 #include <chrono>
+#include <atomic>
+#include <functional>
 #include <boost/asio.hpp>
 #include <nlohmann/json.hpp>
 #include "common/pose.hpp"
+#include "common/shm_ring.hpp"
+#include "common/trace.hpp"
+#include "marshal_segments.hpp"
+#include "marshal_cas.hpp"
+#include "marshal_index_cache.hpp"
+#include "marshal_sched.hpp"
 
 
 struct HubClient { std::shared_ptr<void> ws; }; // opaque holder
@@ -20,9 +28,88 @@ std::string type{"acq"};
 };
 
 
+// Limits enforced by the background retention task; 0 disables a limit.
+struct RetentionPolicy {
+std::chrono::seconds max_age{0};
+uint64_t max_bytes{0};
+size_t max_entries{0};
+std::chrono::seconds interval{30};
+bool limited() const { return max_age.count() || max_bytes || max_entries; }
+};
+
+
+struct RetentionStats {
+std::atomic<bool> running{false};
+std::atomic<uint64_t> passes{0};
+std::atomic<uint64_t> scanned{0};          // entries looked at in the current/last pass
+std::atomic<uint64_t> total{0};            // entries in the index at the start of that pass
+std::atomic<uint64_t> entries_removed{0};  // cumulative
+std::atomic<uint64_t> bytes_reclaimed{0};  // cumulative
+std::atomic<int64_t> last_pass_ms{0};      // wall time of the last completed pass
+};
+
+
+// Startup load of the in-memory index and its snapshots (see marshal_snapshot.hpp).
+struct IndexLoadStats {
+std::atomic<bool> loaded{true};            // index complete and storage recovered; cleared while loading
+std::atomic<bool> from_snapshot{false};
+std::atomic<uint64_t> snapshot_rows{0};    // rows loaded from the snapshot
+std::atomic<uint64_t> tail_rows{0};        // rows parsed from index.jsonl before serving
+std::atomic<int64_t> startup_ms{0};        // load time before serving
+std::atomic<int64_t> backfill_ms{0};       // background load of the older rows and storage recovery
+std::atomic<uint64_t> snapshots{0};        // snapshots written
+std::atomic<uint64_t> snapshot_generation{~0ull}; // index generation of the last one
+std::atomic<int64_t> last_snapshot_ms{0};  // time to write it
+};
+
+
+// Counters of the --upstream link (see marshal_relay.hpp).
+struct RelayStats {
+std::atomic<bool> connected{false};
+std::atomic<uint64_t> connects{0};
+std::atomic<uint64_t> frames{0};         // upstream frames republished locally
+std::atomic<uint64_t> index_entries{0};  // upstream index entries appended locally
+std::atomic<uint64_t> backfills{0};      // HTTP catch-ups of pose and index
+std::atomic<uint64_t> gaps{0};           // upstream frames lost before they reached us
+std::atomic<uint64_t> upstream_seq{0};   // last upstream seq applied
+};
+
+
 struct MarshalState {
 PoseStore poses;
 std::string data_dir{"/data"};
+std::string storage{"files"};              // "files" (one file per blob), "segments" or "cas"
+uint64_t segment_bytes{256ull << 20};      // preallocated size of each segment file
+size_t segment_keep{0};                    // sealed segments to keep; 0 = keep all
+std::unique_ptr<SegmentStore> segments;    // set when storage == "segments"
+std::unique_ptr<CasStore> cas;             // set when storage == "cas"
+std::unique_ptr<Scheduler> sched;          // bulk pool and admission; null = all inline
+uint64_t max_body_bytes{256ull << 20};     // HTTP request body limit (batch ingest)
+std::mutex index_mtx;                      // guards mrd/index.jsonl and mrd/latest.json
+uint64_t index_seq{0};                     // "seq" of the last locally ingested entry (under index_mtx)
+IndexCache index_cache;                    // in-memory copy of both; updated under index_mtx
+IndexLoadStats index_stats;
+std::chrono::seconds snapshot_interval{60}; // index snapshot period, 0 = only after retention and at exit
+std::mutex snapshot_mtx;                   // serializes snapshot writes
+RetentionPolicy retention;
+RetentionStats retention_stats;
+size_t ws_ring{1024};                      // frames kept in memory per topic
+bool ws_log{false};                        // spill frames to ${data_dir}/ws for resume
+size_t ws_max_queue{4096};                 // frames queued per subscriber before it catches up from the log; 0 = unbounded
+std::atomic<uint64_t> ws_lagged{0};        // times a subscriber fell behind and was switched to log replay
+std::atomic<uint64_t> ws_gaps{0};          // replays that found frames already gone from the log
+std::function<void(std::string)> publish;  // hands a frame to the WebSocket fan-out (set by main)
+std::string upstream;                      // --upstream ws URL when relaying
+RelayStats relay_stats;
+std::unique_ptr<shm::ShmBroadcast> shm_out; // local subscribers (--shm); published under ws_mtx
+std::atomic<uint64_t> shm_oversize{0};     // frames too large for a shm_out slot (WebSocket only)
+trace::Stats trace_stats;                  // per-hop latency of sampled frames
+std::unique_ptr<trace::ChromeTraceWriter> trace_dump; // --trace-dump
+uint64_t trace_dump_every{1};              // dump 1 of every N completed traces
+std::atomic<uint64_t> trace_reports{0};
+double preview_hz{10};                     // mrd.preview publish rate, 0 = off
+float preview_saturation{32000.f};         // |re| or |im| at or above counts as saturated
+uint32_t preview_points{32};               // decimated magnitude profile length
 std::mutex ws_mtx;
 std::unordered_set<void*> ws_clients; // track raw ptr keys
 boost::asio::io_context* io = nullptr;
@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// -------- time formatting --------
+
+// RFC3339 UTC with milliseconds (e.g., 2025-09-12T14:59:01.234Z)
+inline std::string iso8601_ms(std::chrono::system_clock::time_point tp) {
+    using namespace std::chrono;
+    auto now = time_point_cast<milliseconds>(tp);
+    auto ms  = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
+    std::time_t tt = system_clock::to_time_t(now);
+    std::tm tm{};
+    gmtime_r(&tt, &tm);
+
+    char base[32];
+    std::strftime(base, sizeof(base), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    std::ostringstream oss;
+    oss << base << '.' << std::setw(3) << std::setfill('0') << ms.count() << 'Z';
+    return oss.str();
+}
+
+inline std::string iso8601_now_ms() { return iso8601_ms(std::chrono::system_clock::now()); }
+
+// True when ts starts like the timestamps above (YYYY-MM-DDTHH:MM:SS), so it
+// orders chronologically as a string.
+inline bool is_iso8601(std::string_view ts) {
+    static constexpr std::string_view shape = "dddd-dd-ddTdd:dd:dd";
+    if (ts.size() < shape.size()) return false;
+    for (size_t i = 0; i < shape.size(); ++i)
+        if (shape[i] == 'd' ? (ts[i] < '0' || ts[i] > '9') : ts[i] != shape[i]) return false;
+    return true;
+}
+
+// Seconds-precision ISO8601 for pose endpoint (keeps your original behavior)
+inline std::string iso8601_now() {
+    using namespace std::chrono;
+    auto t = system_clock::to_time_t(system_clock::now());
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    char buf[64];
+    std::strftime(buf, sizeof(buf), "%FT%TZ", &tm);
+    return buf;
+}
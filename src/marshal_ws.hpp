@@ -2,22 +2,41 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <set>
 #include <mutex>
+#include <unordered_set>
+#include "common/trace.hpp"
 #include "marshal_state.hpp"
+#include "marshal_wslog.hpp"
+#include "marshal_preview.hpp"
 
 namespace websocket = boost::beast::websocket;
 
 class WsServer
 {
+    boost::asio::io_context &ioc_;
     boost::asio::ip::tcp::acceptor acceptor_;
-    boost::asio::ip::tcp::socket socket_;
     MarshalState &state_;
+    MessageLog log_;
+    PreviewStage preview_;
+    boost::asio::thread_pool replay_pool_{1}; // reads replays from the spill files off the io thread
 
 public:
     WsServer(boost::asio::io_context &ioc, boost::asio::ip::tcp::endpoint ep, MarshalState &s)
-        : acceptor_(ioc), socket_(ioc), state_(s)
+        : ioc_(ioc), acceptor_(ioc), state_(s),
+          log_(s.ws_ring, s.ws_log ? std::filesystem::path(s.data_dir) / "ws" : std::filesystem::path()),
+          preview_(s.preview_hz, s.preview_saturation, s.preview_points,
+                   [this](nlohmann::json f)
+                   { boost::asio::post(ioc_, [this, f = std::move(f)]() mutable
+                                       { publish(std::move(f)); }); })
     {
         boost::system::error_code ec;
         acceptor_.open(ep.protocol(), ec);
@@ -26,42 +45,169 @@ public:
         acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
         do_accept();
     }
-    void broadcast(const std::string &msg)
+    MessageLog &log() { return log_; }
+
+    // Frames {topic:..., payload:...} are tagged with "seq" and logged before
+    // fan-out; anything else is forwarded verbatim to unfiltered sessions.
+    // rx_ns is when the frame reached the marshal (for traced frames).
+    // mrd.samples frames go to the preview stage, which parses them itself.
+    void broadcast(std::string msg, int64_t rx_ns = 0)
     {
+        if (PreviewStage::is_samples(msg))
+        {
+            preview_.offer(std::move(msg));
+            return;
+        }
+        broadcast(nlohmann::json::parse(msg, nullptr, false), msg, rx_ns);
+    }
+
+    // Same for a frame the caller already parsed; msg is its text.
+    void broadcast(nlohmann::json j, const std::string &msg, int64_t rx_ns)
+    {
+        if (routed(j))
+            return route(std::move(j), rx_ns);
+        auto text = std::make_shared<const std::string>(msg);
         std::scoped_lock lk(state_.ws_mtx);
+        publish_shm(msg);
         for (auto h : state_.ws_clients)
         {
             auto *s = static_cast<Session *>(h);
-            s->send(msg);
+            if (s->topics.empty())
+                s->send(text);
+        }
+    }
+
+    // Objects the marshal acts on rather than forwards: topic frames and
+    // {"op":"trace"} reports.
+    static bool routed(const nlohmann::json &j)
+    {
+        return j.is_object() && ((j.contains("op") && j["op"] == "trace") ||
+                                 (j.contains("topic") && j["topic"].is_string()));
+    }
+
+    // Handles a routed() object.
+    void route(nlohmann::json j, int64_t rx_ns = 0)
+    {
+        if (j.contains("op") && j["op"] == "trace")
+            return record_trace(j.contains("trace") ? j["trace"] : nlohmann::json());
+        publish(std::move(j), rx_ns);
+    }
+
+    // Logs and fans out one {topic:..., payload:...} frame; a "seq" it
+    // carries (e.g. from an upstream marshal) is replaced by the local one.
+    void publish(nlohmann::json j, int64_t rx_ns = 0)
+    {
+        int64_t enq_ns = 0;
+        if (j.contains("trace") && !trace::valid(j["trace"]))
+            j.erase("trace"); // unreadable context: deliver the frame untraced
+        if (j.contains("trace"))
+        {
+            const int64_t m_rx = rx_ns ? rx_ns : trace::now_ns();
+            trace::stamp(j, "m_rx", m_rx);
+            if (auto send = trace::at(j["trace"], "send"))
+                state_.trace_stats.hops[trace::SendToRx].record(m_rx - *send);
+            enq_ns = trace::now_ns();
+            trace::stamp(j, "m_enq", enq_ns);
+            state_.trace_stats.hops[trace::RxToFanout].record(enq_ns - m_rx);
+        }
+        auto topic = j["topic"].get<std::string>();
+        if (topic == "mrd.samples")
+        {
+            if (j.contains("payload"))
+                preview_.observe(j["payload"]); // input only; the preview thread publishes when due
+            return;
+        }
+        auto frame = log_.append(topic, std::move(j));
+        std::shared_ptr<const std::string> text(frame, &frame->text);
+        {
+            std::scoped_lock lk(state_.ws_mtx);
+            publish_shm(*text);
+            for (auto h : state_.ws_clients)
+            {
+                auto *s = static_cast<Session *>(h);
+                if (s->wants(*frame))
+                    s->send(text, enq_ns, frame->seq);
+            }
         }
     }
 
 private:
+    // Mirrors a frame to local shm subscribers; one that does not fit a slot
+    // still reaches WebSocket subscribers and is counted. Caller holds ws_mtx.
+    void publish_shm(const std::string &text)
+    {
+        if (!state_.shm_out || state_.shm_out->publish(text))
+            return;
+        if (state_.shm_oversize++ == 0)
+            std::cerr << "marshal: " << text.size() << "-byte frame exceeds the shm slot size ("
+                      << state_.shm_out->slot_bytes() << "), shm subscribers miss it; raise --shm-slot-kb\n";
+    }
+
+    // {"op":"trace","trace":{...}} sent back by a consumer once it persisted a traced frame
+    void record_trace(const nlohmann::json &t)
+    {
+        if (!trace::valid(t))
+            return;
+        auto hop = [&](const char *a, const char *b, trace::Hop h)
+        {
+            const auto ta = trace::at(t, a), tb = trace::at(t, b);
+            if (ta && tb)
+                state_.trace_stats.hops[h].record(*tb - *ta);
+        };
+        hop("m_enq", "c_rx", trace::FanoutToConsumer);
+        hop("c_rx", "c_persist", trace::ConsumerPersist);
+        hop("send", "c_persist", trace::EndToEnd);
+        if (state_.trace_dump && state_.trace_reports++ % state_.trace_dump_every == 0)
+            state_.trace_dump->write(t);
+    }
+
     void do_accept()
     {
-        acceptor_.async_accept(socket_, [this](auto ec)
+        acceptor_.async_accept(boost::asio::make_strand(ioc_), [this](auto ec, boost::asio::ip::tcp::socket sock)
                                {
-if(!ec) std::make_shared<Session>(std::move(socket_), state_, *this)->run();
+if(!ec) std::make_shared<Session>(std::move(sock), state_, *this)->run();
 do_accept(); });
     }
     struct Session : std::enable_shared_from_this<Session>
     {
+        struct Outgoing
+        {
+            std::shared_ptr<const std::string> text;
+            int64_t enq_ns; // fan-out time of a traced frame, 0 otherwise
+        };
+
         boost::beast::websocket::stream<boost::asio::ip::tcp::socket> ws;
         boost::beast::flat_buffer buffer;
         MarshalState &state;
         WsServer &server;
-        std::mutex send_mtx;
+        std::deque<Outgoing> outq;              // touched only on the session's strand
+        std::unordered_set<std::string> topics; // empty = all topics (guarded by state.ws_mtx, set on the strand)
+        uint64_t live_from = 0;                 // live frames below this seq were already replayed
+        // strand-only replay state: next logged seq to send (0 = live), frames
+        // replayed for the pending ws.subscribed, and whether to check for loss
+        uint64_t replay_from = 0;
+        uint64_t replayed = 0;
+        bool confirm = false;
+        bool check_gap = false;
+        // strand-only: a spill batch is being read on the replay pool; its
+        // subscription (stale once a newer subscribe arrives); where it stopped
+        bool reading = false;
+        uint64_t subscription = 0;
+        MessageLog::SpillCursor cursor;
         Session(boost::asio::ip::tcp::socket &&s, MarshalState &st, WsServer &sv)
             : ws(std::move(s)), state(st), server(sv) {}
         void run()
         {
             ws.set_option(websocket::stream_base::timeout::suggested(boost::beast::role_type::server));
-            ws.accept();
-            {
-                std::scoped_lock lk(state.ws_mtx);
-                state.ws_clients.insert(this);
-            }
-            do_read();
+            auto self = shared_from_this();
+            ws.async_accept([self](auto ec)
+                            {
+                if (ec) return;
+                {
+                    std::scoped_lock lk(self->state.ws_mtx);
+                    self->state.ws_clients.insert(self.get());
+                }
+                self->do_read(); });
         }
         ~Session()
         {
@@ -72,20 +218,235 @@ do_accept(); });
         {
             auto self = shared_from_this();
             ws.async_read(buffer, [self](auto ec, auto)
-                          { if(!ec){ self->on_msg(); self->do_read(); } });
+                          {
+                if (ec) return;
+                try
+                {
+                    self->on_msg();
+                }
+                catch (const std::exception &e)
+                {
+                    // one malformed client frame must not take down the io thread
+                    std::cerr << "marshal: dropped ws frame: " << e.what() << "\n";
+                }
+                self->do_read(); });
+        }
+        bool wants(const LoggedFrame &f) const
+        {
+            return f.seq >= live_from && (topics.empty() || topics.count(f.topic));
         }
         void on_msg()
         {
+            const int64_t rx_ns = trace::now_ns();
             auto data = boost::beast::buffers_to_string(buffer.data());
             buffer.consume(buffer.size());
+            if (PreviewStage::is_samples(data))
+            {
+                server.preview_.offer(std::move(data)); // parsed on the preview thread
+                return;
+            }
+            auto j = nlohmann::json::parse(data, nullptr, false);
+            if (j.is_object() && j.contains("op") && j["op"].is_string() && j["op"].get<std::string>() == "subscribe")
+                return subscribe(j);
+            // an array of frames is a batch from a batching client; any
+            // other array is an ordinary message
+            if (j.is_array() && !j.empty() && std::all_of(j.begin(), j.end(), &WsServer::routed))
+            {
+                for (auto &f : j)
+                    server.route(std::move(f), rx_ns);
+                return;
+            }
             // echo or route by {topic:..., payload:...}
-            server.broadcast(data); // naive fan-out
+            server.broadcast(std::move(j), data, rx_ns); // naive fan-out
+        }
+        // {"op":"subscribe", "topics":[...], "from_seq":N | "last":K}
+        // Replays logged frames at full speed, then switches to live delivery
+        // without gaps or duplicates, and confirms with a ws.subscribed frame.
+        // A malformed request is answered with ws.error and changes nothing; a
+        // from_seq past the head is reported with ws.gap before going live.
+        void subscribe(const nlohmann::json &req)
+        {
+            auto count = [&](const char *k)
+            { return !req.contains(k) || req[k].is_number_unsigned(); };
+            if ((req.contains("topics") && !req["topics"].is_array()) || !count("from_seq") || !count("last"))
+                return enqueue({std::make_shared<const std::string>(
+                                    nlohmann::json{{"topic", "ws.error"},
+                                                   {"payload", {{"error", "bad subscribe request"},
+                                                                {"expected", "topics: array, from_seq/last: unsigned"}}}}
+                                        .dump()),
+                                0});
+
+            std::unordered_set<std::string> want;
+            if (req.contains("topics"))
+                for (auto &t : req["topics"])
+                    if (t.is_string())
+                        want.insert(t.get<std::string>());
+
+            auto &log = server.log();
+            const uint64_t head = log.head();
+            uint64_t from = head + 1;
+            if (req.contains("from_seq"))
+                from = std::max<uint64_t>(req["from_seq"].get<uint64_t>(), 1);
+            else if (req.contains("last"))
+                from = log.last_k_from(want, req["last"].get<size_t>());
+            if (from > head + 1)
+            {
+                // a cursor past the head was taken in another epoch: say so
+                // instead of quietly going live, so the client can reset
+                enqueue({std::make_shared<const std::string>(
+                             nlohmann::json{{"topic", "ws.gap"},
+                                            {"payload", {{"from_seq", from}, {"head_seq", head}, {"epoch", log.epoch()}}}}
+                                 .dump()),
+                         0});
+                from = head + 1;
+            }
+
+            {
+                std::scoped_lock lk(state.ws_mtx);
+                topics = want;
+                live_from = std::numeric_limits<uint64_t>::max(); // paused while replaying
+            }
+            replay_from = from;
+            replayed = 0;
+            ++subscription;
+            confirm = true;
+            check_gap = req.contains("from_seq");
+            replay();
         }
-        void send(const std::string &s)
+        // Queues logged frames from replay_from on, at most ws_max_queue at a
+        // time (the rest follow as the queue drains), then switches to live
+        // delivery without gaps or duplicates. Frames that are no longer
+        // logged are reported once with a ws.gap frame. Batches that have to
+        // come from the spill files are read on the replay pool, so a deep
+        // replay never blocks the io thread.
+        void replay()
         {
-            std::scoped_lock lk(send_mtx);
+            if (reading)
+                return; // resumed when the batch arrives
+            auto &log = server.log();
+            const size_t cap = state.ws_max_queue ? state.ws_max_queue : std::numeric_limits<size_t>::max();
+            if (check_gap)
+            {
+                check_gap = false;
+                if (!log.covers(topics, replay_from))
+                {
+                    ++state.ws_gaps;
+                    enqueue({std::make_shared<const std::string>(
+                                 nlohmann::json{{"topic", "ws.gap"}, {"payload", {{"from_seq", replay_from}}}}.dump()),
+                             0});
+                }
+            }
+            for (;;)
+            {
+                if (outq.size() >= cap)
+                    return; // resumed from do_write once the queue drains
+                if (!log.in_memory(topics, replay_from))
+                    return read_spill(cap - outq.size());
+                auto [frames, through] = log.since(topics, replay_from, cap - outq.size(), &cursor);
+                queue_replayed(frames, through);
+                if (!frames.empty())
+                    continue;
+                // caught up: re-check under ws_mtx so no broadcast slips between replay and live
+                std::scoped_lock lk(state.ws_mtx);
+                auto [more, h2] = log.since(topics, replay_from, 1, &cursor);
+                if (more.empty())
+                {
+                    live_from = h2 + 1;
+                    break;
+                }
+            }
+            replay_from = 0;
+            if (confirm)
+            {
+                confirm = false;
+                enqueue({std::make_shared<const std::string>(
+                             nlohmann::json{{"topic", "ws.subscribed"},
+                                            {"payload", {{"replayed", replayed}, {"head_seq", live_from - 1}, {"epoch", server.log().epoch()}}}}
+                                 .dump()),
+                         0});
+            }
+        }
+        // Reads the next batch of at most `limit` frames from the spill files
+        // on the replay pool and continues the replay with it on the strand.
+        void read_spill(size_t limit)
+        {
+            reading = true;
+            auto self = shared_from_this();
+            boost::asio::post(server.replay_pool_, [self, limit, want = topics, from = replay_from, at = cursor, sub = subscription]() mutable
+                              {
+                auto batch = self->server.log().since(want, from, limit, &at);
+                boost::asio::post(self->ws.get_executor(), [self, batch = std::move(batch), at, from, sub]
+                                  {
+                    self->reading = false;
+                    self->cursor = at;
+                    if (sub == self->subscription && at.gap)
+                    {
+                        // the spill file holding `from` was rolled away meanwhile
+                        ++self->state.ws_gaps;
+                        self->enqueue({std::make_shared<const std::string>(
+                                           nlohmann::json{{"topic", "ws.gap"}, {"payload", {{"from_seq", from}}}}.dump()),
+                                       0});
+                    }
+                    if (sub == self->subscription)
+                        self->queue_replayed(batch.first, batch.second);
+                    if (self->replay_from)
+                        self->replay(); }); });
+        }
+        // Queues replayed frames; the replay continues after `through`.
+        void queue_replayed(const std::vector<FramePtr> &frames, uint64_t through)
+        {
+            for (auto &f : frames)
+                enqueue({std::shared_ptr<const std::string>(f, &f->text), 0});
+            replayed += frames.size();
+            replay_from = std::max(replay_from, through + 1);
+        }
+        // Queues a frame; safe from any thread. Writes run one at a time on the strand.
+        // A live frame (seq != 0) that finds ws_max_queue frames waiting pauses
+        // live delivery: the session catches up from the log once it drains, so
+        // a slow reader costs bounded memory and still sees every frame.
+        void send(std::shared_ptr<const std::string> text, int64_t enq_ns = 0, uint64_t seq = 0)
+        {
+            auto self = weak_from_this().lock();
+            if (!self)
+                return; // being destroyed
+            boost::asio::post(ws.get_executor(), [self, text = std::move(text), enq_ns, seq]() mutable
+                              {
+                if (seq && seq < self->live_from)
+                    return; // paused (or already replayed): the log has it
+                if (seq && self->state.ws_max_queue && self->outq.size() >= self->state.ws_max_queue)
+                {
+                    {
+                        std::scoped_lock lk(self->state.ws_mtx);
+                        self->live_from = std::numeric_limits<uint64_t>::max();
+                    }
+                    self->replay_from = seq;
+                    self->check_gap = true;
+                    ++self->state.ws_lagged;
+                    return;
+                }
+                self->enqueue({std::move(text), enq_ns}); });
+        }
+        void enqueue(Outgoing o)
+        {
+            outq.push_back(std::move(o));
+            if (outq.size() == 1)
+                do_write();
+        }
+        void do_write()
+        {
+            auto self = shared_from_this();
             ws.text(true);
-            ws.write(boost::asio::buffer(s));
+            ws.async_write(boost::asio::buffer(*outq.front().text), [self](auto ec, auto)
+                           {
+                if (ec) return;
+                if (auto enq = self->outq.front().enq_ns)
+                    self->state.trace_stats.hops[trace::FanoutToWrite].record(trace::now_ns() - enq);
+                self->outq.pop_front();
+                const bool more = !self->outq.empty();
+                if (self->replay_from && self->outq.size() <= self->state.ws_max_queue / 2)
+                    self->replay(); // refills the queue; starts writing only if it was empty
+                if (more)
+                    self->do_write(); });
         }
     };
-};
\ No newline at end of file
+};
@@ -0,0 +1,371 @@
+#pragma once
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// -------- WebSocket message log --------
+//
+// Every broadcast frame gets a monotonically increasing "seq" and is kept in
+// a bounded per-topic ring. With a spill directory, frames are also appended
+// to rolling files ws_<first seq>.log (one JSON frame per line), which lets
+// subscribers resume from sequences that already fell out of memory and keeps
+// sequences monotonic across restarts. append() only buffers the spill
+// lines; a writer thread puts them on disk every kFlushEvery (sooner once
+// kFlushBytes piled up), and a replay from the spill files writes out what
+// is still buffered first.
+//
+// epoch() names the numbering: it is stored in the spill directory and
+// survives clean restarts with it, and is new after a crash and for every
+// run without one. A peer that sees it change knows earlier sequence numbers
+// no longer apply.
+
+struct LoggedFrame {
+    uint64_t    seq{0};
+    std::string topic;
+    std::string text;  // serialized frame, including "seq"
+};
+
+using FramePtr = std::shared_ptr<const LoggedFrame>;
+
+class MessageLog {
+    struct Ring {
+        std::deque<FramePtr> frames;
+        uint64_t floor{0};  // every frame of this topic with seq >= floor is in `frames`
+    };
+
+    std::mutex m_;
+    size_t ring_size_;
+    uint64_t next_seq_{1};
+    uint64_t start_floor_{1};  // frames before this were logged by a previous run
+    std::unordered_map<std::string, Ring> rings_;
+    std::string epoch_;
+
+    // Spill lines not written yet, under m_; a chunk with file_seq != 0
+    // starts the file ws_<file_seq>.log.
+    struct SpillChunk {
+        uint64_t file_seq{0};
+        std::string text;
+    };
+    static constexpr auto kFlushEvery = std::chrono::milliseconds(50);
+    static constexpr size_t kFlushBytes = 1 << 20;
+
+    std::filesystem::path spill_dir_;
+    uint64_t spill_file_bytes_;
+    size_t spill_files_;
+    std::vector<SpillChunk> pending_;
+    size_t pending_bytes_{0};
+    uint64_t spill_written_{0};  // bytes appended to the current file, under m_
+    std::condition_variable_any flush_cv_;
+
+    std::mutex spill_m_;  // the file itself: writes, rolls and replays opening files
+    std::ofstream spill_;
+    std::jthread writer_;  // last: stops before the members it uses go away
+
+public:
+    explicit MessageLog(size_t ring_size, std::filesystem::path spill_dir = {},
+                        uint64_t spill_file_bytes = 64ull << 20, size_t spill_files = 16)
+        : ring_size_(std::max<size_t>(ring_size, 1)), spill_dir_(std::move(spill_dir)),
+          spill_file_bytes_(spill_file_bytes), spill_files_(std::max<size_t>(spill_files, 1)) {
+        if (spill_dir_.empty()) {
+            epoch_ = new_epoch();
+            return;
+        }
+        std::filesystem::create_directories(spill_dir_);
+        std::ifstream(spill_dir_ / "epoch") >> epoch_;
+        // A run that died lost the frames still buffered, which subscribers
+        // may already hold; numbering on after what reached the disk would
+        // hand their seqs out again. Only a clean shutdown keeps the epoch.
+        std::error_code ec;
+        const bool clean = std::filesystem::remove(spill_dir_ / "clean", ec);
+        auto files = spill_list();
+        if (epoch_.empty() || (!clean && !files.empty()))
+            std::ofstream(spill_dir_ / "epoch", std::ios::trunc) << (epoch_ = new_epoch()) << '\n';
+        if (!files.empty()) {
+            // resume numbering after the last frame of the newest file
+            std::ifstream f(files.back().second);
+            std::string line;
+            uint64_t last = 0;
+            while (std::getline(f, line)) {
+                auto j = nlohmann::json::parse(line, nullptr, false);
+                if (j.is_object()) last = std::max(last, j.value("seq", uint64_t{0}));
+            }
+            next_seq_ = std::max(last, files.back().first) + 1;
+        }
+        start_floor_ = next_seq_;
+        roll_spill(next_seq_);
+        writer_ = std::jthread([this](std::stop_token st) { write_spill_loop(st); });
+    }
+
+    ~MessageLog() {
+        if (!spilling()) return;
+        writer_.request_stop();
+        writer_.join();
+        try {
+            sync_spill();
+            if (spill_.good()) std::ofstream(spill_dir_ / "clean") << epoch_ << '\n';
+        } catch (const std::exception& e) {
+            std::cerr << "marshal: ws log write failed: " << e.what() << "\n";
+        }
+    }
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    bool spilling() const { return !spill_dir_.empty(); }
+    const std::string& epoch() const { return epoch_; }
+
+    uint64_t head() {
+        std::scoped_lock lk(m_);
+        return next_seq_ - 1;
+    }
+
+    // Tags `frame` with the next sequence, stores it and returns it.
+    FramePtr append(const std::string& topic, nlohmann::json frame) {
+        std::scoped_lock lk(m_);
+        const uint64_t seq = next_seq_++;
+        frame["seq"] = seq;
+        auto p = std::make_shared<const LoggedFrame>(LoggedFrame{seq, topic, frame.dump()});
+
+        auto [it, fresh] = rings_.try_emplace(topic);
+        auto& r = it->second;
+        if (fresh) r.floor = start_floor_;
+        r.frames.push_back(p);
+        if (r.frames.size() > ring_size_) {
+            r.floor = r.frames.front()->seq + 1;
+            r.frames.pop_front();
+        }
+
+        if (spilling()) {
+            if (pending_.empty()) pending_.emplace_back();
+            pending_.back().text += p->text;
+            pending_.back().text += '\n';
+            pending_bytes_ += p->text.size() + 1;
+            spill_written_ += p->text.size() + 1;
+            if (spill_written_ >= spill_file_bytes_) {
+                pending_.push_back({next_seq_, {}});
+                spill_written_ = 0;
+            }
+            if (pending_bytes_ >= kFlushBytes) flush_cv_.notify_one();
+        }
+        return p;
+    }
+
+    // Where a replay from the spill files stopped, so the next call resumes
+    // there instead of rescanning the file. Every line of `file` before
+    // `offset` has a seq below `from`. `gap` is set by a call that found
+    // frames it was asked for already deleted with their file.
+    struct SpillCursor {
+        std::filesystem::path file;  // empty = not positioned
+        std::streamoff offset{0};
+        uint64_t from{0};
+        bool gap{false};
+    };
+
+    // Frames of the given topics (empty = all) with seq >= from, oldest first,
+    // at most `limit` of them. Also returns the seq through which the result
+    // is complete: the log head at the time of the call, or the last frame
+    // returned when `limit` cut the result short. A cursor makes repeated
+    // calls from the spill files resume where the previous one stopped.
+    // The spill files a call reads are opened before any of them is read,
+    // so a roll cannot delete them under it.
+    std::pair<std::vector<FramePtr>, uint64_t> since(const std::unordered_set<std::string>& topics, uint64_t from,
+                                                     size_t limit = std::numeric_limits<size_t>::max(),
+                                                     SpillCursor* cursor = nullptr) {
+        if (cursor) cursor->gap = false;
+        std::unique_lock lk(m_);
+        const uint64_t head = next_seq_ - 1;
+        if (from > head || limit == 0) return {{}, from > head ? head : from - 1};
+
+        std::vector<FramePtr> out;
+        if (in_memory_locked(topics, from) || !spilling()) {
+            for (auto& [t, r] : rings_) {
+                if (!topics.empty() && !topics.count(t)) continue;
+                auto first = std::lower_bound(r.frames.begin(), r.frames.end(), from,
+                                              [](const FramePtr& f, uint64_t s) { return f->seq < s; });
+                out.insert(out.end(), first, r.frames.end());
+            }
+            std::sort(out.begin(), out.end(), [](auto& a, auto& b) { return a->seq < b->seq; });
+            if (out.size() <= limit) return {std::move(out), head};
+            out.resize(limit);
+            const uint64_t through = out.back()->seq;
+            return {std::move(out), through};
+        }
+
+        // older than the rings: replay from the spill files (complete up to head)
+        lk.unlock();
+        std::unique_lock slk(spill_m_);
+        sync_spill_locked();
+        auto files = spill_list();
+        size_t i = 0;
+        std::streamoff offset = 0;
+        auto at = std::find_if(files.begin(), files.end(), [&](auto& f) { return cursor && f.second == cursor->file; });
+        if (at != files.end() && cursor->from <= from) {
+            i = static_cast<size_t>(at - files.begin());
+            offset = cursor->offset;
+        } else {
+            while (i + 1 < files.size() && files[i + 1].first <= from) ++i;
+        }
+        // frames below the oldest file left with the files rolled away
+        const bool gap = files.empty() || files[i].first > from;
+        std::vector<std::ifstream> open;
+        for (size_t k = i; k < files.size(); ++k) open.emplace_back(files[k].second);
+        slk.unlock();
+        auto stop = [&](uint64_t through, const std::filesystem::path& file, std::streamoff pos) {
+            if (cursor) *cursor = pos < 0 ? SpillCursor{{}, 0, 0, gap} : SpillCursor{file, pos, through + 1, gap};
+            return std::pair{std::move(out), through};
+        };
+        std::streamoff pos = 0;
+        for (size_t first = i; i < files.size(); ++i, offset = 0) {
+            auto& f = open[i - first];
+            f.seekg(offset);
+            std::string line;
+            for (;;) {
+                pos = f.tellg();
+                // a line without its newline is still being written, and newer than head
+                if (!std::getline(f, line) || f.eof()) break;
+                auto j = nlohmann::json::parse(line, nullptr, false);
+                if (!j.is_object()) continue;
+                auto seq = j.value("seq", uint64_t{0});
+                if (seq < from) continue;
+                if (seq > head) return stop(head, files[i].second, pos);
+                auto topic = j.value("topic", std::string());
+                if (!topics.empty() && !topics.count(topic)) continue;
+                out.push_back(std::make_shared<const LoggedFrame>(LoggedFrame{seq, std::move(topic), line}));
+                if (out.size() >= limit) return stop(seq, files[i].second, f.tellg());
+            }
+        }
+        return stop(head, files.empty() ? std::filesystem::path() : files.back().second, pos);
+    }
+
+    // True when frames from `from` on are still in the rings, so since()
+    // does not touch the spill files.
+    bool in_memory(const std::unordered_set<std::string>& topics, uint64_t from) {
+        std::scoped_lock lk(m_);
+        return !spilling() || from >= next_seq_ || in_memory_locked(topics, from);
+    }
+
+    // True when every frame of the given topics with seq >= from can still be
+    // replayed, from the rings or the spill files.
+    bool covers(const std::unordered_set<std::string>& topics, uint64_t from) {
+        std::scoped_lock lk(m_);
+        return spilling() || from >= next_seq_ || in_memory_locked(topics, from);
+    }
+
+    // First sequence of the last k frames of the given topics (empty = all).
+    uint64_t last_k_from(const std::unordered_set<std::string>& topics, size_t k) {
+        std::scoped_lock lk(m_);
+        std::vector<uint64_t> seqs;
+        for (auto& [t, r] : rings_) {
+            if (!topics.empty() && !topics.count(t)) continue;
+            for (auto& f : r.frames) seqs.push_back(f->seq);
+        }
+        if (k == 0 || seqs.empty()) return next_seq_;
+        std::sort(seqs.begin(), seqs.end());
+        return seqs[seqs.size() - std::min(k, seqs.size())];
+    }
+
+private:
+    static std::string new_epoch() {
+        std::random_device rd;
+        char buf[17];
+        std::snprintf(buf, sizeof buf, "%08x%08x", rd(), rd());
+        return buf;
+    }
+
+    bool in_memory_locked(const std::unordered_set<std::string>& topics, uint64_t from) const {
+        bool in_memory = true;
+        if (topics.empty()) {
+            in_memory = from >= start_floor_;
+            for (auto& [t, r] : rings_) in_memory = in_memory && from >= r.floor;
+        } else {
+            for (auto& t : topics) {
+                auto it = rings_.find(t);
+                in_memory = in_memory && from >= (it == rings_.end() ? start_floor_ : it->second.floor);
+            }
+        }
+        return in_memory;
+    }
+
+    std::vector<std::pair<uint64_t, std::filesystem::path>> spill_list() const {
+        std::vector<std::pair<uint64_t, std::filesystem::path>> out;
+        std::error_code ec;
+        for (auto& de : std::filesystem::directory_iterator(spill_dir_, ec)) {
+            auto n = de.path().filename().string();
+            if (n.rfind("ws_", 0) != 0 || de.path().extension() != ".log") continue;
+            try { out.emplace_back(std::stoull(n.substr(3)), de.path()); } catch (...) {}
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    // Body of the writer thread.
+    void write_spill_loop(std::stop_token st) {
+        while (!st.stop_requested()) {
+            {
+                std::unique_lock lk(m_);
+                flush_cv_.wait_for(lk, st, kFlushEvery, [&] { return pending_bytes_ >= kFlushBytes; });
+            }
+            try {
+                sync_spill();
+            } catch (const std::exception& e) {
+                std::cerr << "marshal: ws log write failed: " << e.what() << "\n";
+            }
+        }
+    }
+
+    void sync_spill() {
+        std::scoped_lock slk(spill_m_);
+        sync_spill_locked();
+    }
+
+    // Writes out and flushes the buffered spill lines. Caller holds spill_m_.
+    void sync_spill_locked() {
+        std::vector<SpillChunk> chunks;
+        {
+            std::scoped_lock lk(m_);
+            chunks.swap(pending_);
+            pending_bytes_ = 0;
+        }
+        if (chunks.empty()) return;
+        for (auto& c : chunks) {
+            if (c.file_seq) roll_spill(c.file_seq);
+            spill_.write(c.text.data(), static_cast<std::streamsize>(c.text.size()));
+        }
+        spill_.flush();
+    }
+
+    // Starts ws_<first_seq>.log and drops the oldest files beyond
+    // spill_files_. Caller holds spill_m_ (or is the constructor).
+    void roll_spill(uint64_t first_seq) {
+        if (spill_.is_open()) spill_.close();
+        char name[40];
+        std::snprintf(name, sizeof(name), "ws_%012llu.log", static_cast<unsigned long long>(first_seq));
+        spill_.open(spill_dir_ / name, std::ios::app);
+        if (!spill_) throw std::runtime_error("open ws log failed: " + (spill_dir_ / name).string());
+
+        auto files = spill_list();
+        for (size_t i = 0; i + spill_files_ < files.size(); ++i) {
+            std::error_code ec;
+            std::filesystem::remove(files[i].second, ec);
+        }
+    }
+};
@@ -0,0 +1,24 @@
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <thread>
+#include "client/http_client.hpp"
+#include "marshal_http.hpp"
+
+TEST_CASE("url parsing fills in default ports and targets"){
+auto u = client::parse_url("ws://example:8090/ws");
+REQUIRE(u.scheme == "ws"); REQUIRE(u.host == "example"); REQUIRE(u.port == "8090"); REQUIRE(u.target == "/ws");
+auto v = client::parse_url("http://example");
+REQUIRE(v.port == "80"); REQUIRE(v.target == "/"); REQUIRE(v.authority() == "example:80");
+}
+
+TEST_CASE("http client pipelines requests over one keep-alive connection"){
+MarshalState st; boost::asio::io_context ioc;
+HttpServer srv(ioc, {boost::asio::ip::make_address("127.0.0.1"), 18181}, st);
+std::thread io([&]{ ioc.run(); });
+client::HttpOptions opt; opt.max_connections = 1; opt.max_pipeline = 8;
+auto c = client::HttpClient::create(ioc, client::parse_url("http://127.0.0.1:18181"), opt);
+std::vector<std::future<client::Response>> rs;
+for (int i = 0; i < 32; ++i) rs.push_back(c->request(c->make(boost::beast::http::verb::get, "/health")));
+for (auto& r : rs) { auto res = r.get(); REQUIRE(res.result_int() == 200); REQUIRE(res.keep_alive()); }
+ioc.stop(); io.join();
+}
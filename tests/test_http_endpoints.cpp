@@ -1,8 +1,38 @@
 #include <catch2/catch_all.hpp>
 #include <boost/asio.hpp>
 #include <boost/beast/http.hpp>
+#include <future>
+#include <thread>
+#include "marshal_http.hpp"
 
 
 TEST_CASE("dummy http test placeholder"){
 REQUIRE(true);
-}
\ No newline at end of file
+}
+
+
+TEST_CASE("scheduler classifies routes and rejects beyond burst and queue"){
+REQUIRE(classify("/v1/pose/current") == RouteClass::Critical);
+REQUIRE(classify("/v1/mrd/ingest/batch") == RouteClass::Bulk);
+Scheduler s(1, 1, 1.0, 2.0);
+REQUIRE(s.admit("a")); REQUIRE(s.admit("a")); REQUIRE(!s.admit("a")); REQUIRE(s.admit("b"));
+std::promise<void> gate; auto open = gate.get_future().share();
+REQUIRE(s.submit([open]{ open.wait(); }));
+REQUIRE(!s.accepting()); REQUIRE(!s.submit([]{}));
+gate.set_value();
+while (s.stats.bulk_pending.load()) std::this_thread::yield();
+REQUIRE(s.accepting());
+}
+
+TEST_CASE("a bulk job that throws reports the error instead of swallowing it"){
+Scheduler s(1, 4, 0, 1.0);
+std::promise<std::string> err; auto got = err.get_future();
+REQUIRE(s.submit([]{ throw std::runtime_error("disk full"); },
+[&](const std::string& what){ err.set_value(what); }));
+REQUIRE(got.get() == "disk full");
+while (s.stats.bulk_pending.load()) std::this_thread::yield();
+REQUIRE(s.stats.failed == 1);
+REQUIRE(s.submit([]{ throw 1; }));   // without a callback it is still only logged
+while (s.stats.bulk_pending.load()) std::this_thread::yield();
+REQUIRE(s.to_json()["failed_500"] == 2);
+}
@@ -0,0 +1,77 @@
+#include <catch2/catch_all.hpp>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "client/http_client.hpp"
+#include "marshal_http.hpp"
+
+namespace fs = std::filesystem;
+using nlohmann::json;
+
+static std::string framed(const std::vector<std::string>& blobs){
+std::string out;
+for (auto& b : blobs) {
+uint32_t n = static_cast<uint32_t>(b.size());
+for (int i = 0; i < 4; ++i) out += static_cast<char>(n >> (8 * i) & 0xff);
+out += b;
+}
+return out;
+}
+
+
+TEST_CASE("parse_batch splits length-prefixed blobs and rejects malformed bodies"){
+std::vector<std::pair<const char*, size_t>> out;
+auto body = framed({"abc", "de"});
+REQUIRE(parse_batch(body, out)); REQUIRE(out.size() == 2);
+REQUIRE(std::string(out[0].first, out[0].second) == "abc"); REQUIRE(std::string(out[1].first, out[1].second) == "de");
+for (std::string bad : {std::string(), body.substr(0, body.size() - 1), body + "\x01\x00",
+                        framed({""}), std::string("\xff\xff\xff\x7f" "abc", 7)}) {
+out.clear();
+REQUIRE(!parse_batch(bad, out));
+}
+}
+
+TEST_CASE("batch ingest stores every blob and commits them in ts and seq order"){
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_batch").string();
+fs::remove_all(st.data_dir);
+st.segments = std::make_unique<SegmentStore>(fs::path(st.data_dir) / "mrd" / "segments", 1 << 20);
+boost::asio::io_context ioc;
+HttpServer srv(ioc, {boost::asio::ip::make_address("127.0.0.1"), 18182}, st);
+std::thread io([&]{ ioc.run(); });
+auto c = client::HttpClient::create(ioc, client::parse_url("http://127.0.0.1:18182"));
+namespace http = boost::beast::http;
+
+auto res = c->request(c->make(http::verb::post, "/v1/mrd/ingest/batch", framed({"one", "two", "three"}))).get();
+REQUIRE(res.result_int() == 201);
+auto j = json::parse(res.body());
+REQUIRE(j["count"] == 3); REQUIRE(j["entries"][2]["length"] == 5);
+REQUIRE(c->request(c->make(http::verb::post, "/v1/mrd/ingest/batch", "\x05\x00\x00\x00" "ab")).get().result_int() == 400);
+
+// concurrent commits still land in the index with increasing ts and seq
+std::vector<std::thread> ws;
+for (int t = 0; t < 4; ++t)
+ws.emplace_back([&]{ for (int i = 0; i < 25; ++i) { std::string b = "x"; commit_entries(st, store_blobs(st, {{b.data(), b.size()}})); } });
+for (auto& w : ws) w.join();
+std::string prev_ts; uint64_t prev_seq = 0, n = 0;
+for_each_index_entry(index_path(st), [&](const json& e){
+REQUIRE(e["ts"].get<std::string>() >= prev_ts); REQUIRE(e["seq"].get<uint64_t>() == prev_seq + 1);
+prev_ts = e["ts"]; prev_seq = e["seq"]; ++n;
+});
+REQUIRE(n == 103);
+c->shutdown(); ioc.stop(); io.join();
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("blob files are named independently of the entry ts and seq"){
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_blob_names").string();
+fs::remove_all(st.data_dir);
+std::string a = "a", b = "bb";
+auto e = commit_entries(st, store_blobs(st, {{a.data(), a.size()}, {b.data(), b.size()}}));
+REQUIRE(e.size() == 2);
+const fs::path p0 = e[0]["path"].get<std::string>(), p1 = e[1]["path"].get<std::string>();
+REQUIRE(p0 != p1); REQUIRE(fs::file_size(p0) == 1); REQUIRE(fs::file_size(p1) == 2);
+REQUIRE(p0.extension() == ".mrd");
+REQUIRE(p0.filename().string().find(e[0]["ts"].get<std::string>()) == std::string::npos);
+fs::remove_all(st.data_dir);
+}
@@ -5,4 +5,14 @@
 TEST_CASE("pose store roundtrip"){
 PoseStore s; Pose p; p.p={1,2,3}; s.set(p); auto q=s.get();
 REQUIRE(q.p[0]==1); REQUIRE(q.p[1]==2); REQUIRE(q.p[2]==3);
-}
\ No newline at end of file
+}
+TEST_CASE("pose json roundtrip"){
+Pose p; p.p={1,2,3}; p.R={0,1,0, -1,0,0, 0,0,1}; p.source="relay"; p.t=std::chrono::system_clock::time_point(std::chrono::milliseconds(1234));
+Pose q; REQUIRE(pose_from_json(pose_to_json(p), q));
+REQUIRE(q.p==p.p); REQUIRE(q.R==p.R); REQUIRE(q.source=="relay"); REQUIRE(q.t==p.t);
+REQUIRE(!pose_from_json(nlohmann::json{{"p",{1,2}}}, q));
+REQUIRE(!pose_from_json(nlohmann::json{{"p",{1,2,3}},{"frame",7}}, q));
+REQUIRE(!pose_from_json(nlohmann::json{{"p",{1,2,3}},{"t_ms","soon"}}, q));
+REQUIRE(!pose_from_json(nlohmann::json{{"p",{1,2,"x"}}}, q));
+REQUIRE(q.p==p.p);
+}
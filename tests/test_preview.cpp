@@ -0,0 +1,82 @@
+#include <catch2/catch_all.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "common/base64.hpp"
+#include "common/preview.hpp"
+#include "marshal_preview.hpp"
+
+TEST_CASE("base64 roundtrips every tail length"){
+for (size_t n = 0; n < 8; ++n) {
+std::string in(n, '\0'); for (size_t i = 0; i < n; ++i) in[i] = static_cast<char>(0xF0 + i);
+std::string out; REQUIRE(base64::decode(base64::encode(in.data(), in.size()), out)); REQUIRE(out == in);
+}
+std::string bad; REQUIRE(!base64::decode("ab$d", bad));
+}
+
+TEST_CASE("every supported preview kernel matches the scalar one"){
+std::mt19937 rng(7); std::normal_distribution<float> d(0, 100);
+const uint32_t C = 4, N = 301;  // not a multiple of any vector width
+std::vector<float> iq(2 * C * N); for (auto& x : iq) x = d(rng);
+iq[2 * 5] = 40000; iq[2 * (N + 9) + 1] = -40000;
+auto ref = preview::summarize(iq.data(), C, N, 32000, 16, preview::coil_scalar);
+auto kernels = preview::supported();
+REQUIRE(std::string(kernels.back().isa) == "scalar");
+REQUIRE(std::string(kernels.front().isa) == preview::dispatch().isa);
+for (auto& k : kernels) {
+INFO(k.isa);
+auto got = preview::summarize(iq.data(), C, N, 32000, 16, k.kernel);
+for (uint32_t c = 0; c < C; ++c) {
+REQUIRE(std::abs(got[c].rms - ref[c].rms) <= 1e-5f * ref[c].rms);
+REQUIRE(got[c].peak == ref[c].peak);
+REQUIRE(got[c].saturated == ref[c].saturated);
+REQUIRE(got[c].profile.size() == 16);
+for (size_t j = 0; j < 16; ++j) REQUIRE(std::abs(int(got[c].profile[j]) - int(ref[c].profile[j])) <= 1);
+}
+}
+REQUIRE(ref[0].saturated == 1); REQUIRE(ref[1].saturated == 1); REQUIRE(ref[2].saturated == 0);
+}
+
+TEST_CASE("preview profiles have exactly the requested number of points"){
+std::vector<float> iq(2 * 1000, 1.f);
+REQUIRE(preview::summarize(iq.data(), 1, 1000, 32000, 300)[0].profile.size() == 300);
+REQUIRE(preview::summarize(iq.data(), 1, 1000, 32000, 7)[0].profile.size() == 7);
+REQUIRE(preview::summarize(iq.data(), 1, 10, 32000, 300)[0].profile.size() == 10);   // at most one per sample
+auto flat = preview::summarize(iq.data(), 1, 1000, 32000, 300);
+for (auto v : flat[0].profile) REQUIRE(int(v) == 255);
+}
+
+TEST_CASE("preview stage rejects sample counts whose product overflows"){
+std::mutex m; std::condition_variable cv; int published = 0;
+PreviewStage stage(1000, 32000, 8, [&](nlohmann::json) { std::scoped_lock lk(m); ++published; cv.notify_all(); });
+auto acq = [](uint64_t channels, uint64_t n, std::string iq) {
+return nlohmann::json{{"channels", channels}, {"n", n}, {"iq", std::move(iq)}};
+};
+// 8 * 2^31 * 2^30 wraps to 0 and would match an empty decode
+REQUIRE(!stage.observe(acq(2147483648ull, 1073741824ull, "")));
+// in range, but the samples do not match the counts
+REQUIRE(stage.observe(acq(65535, 65535, "")));
+std::vector<float> iq(2 * 2 * 4, 1.f);
+REQUIRE(stage.observe(acq(2, 4, base64::encode(reinterpret_cast<const char*>(iq.data()), iq.size() * sizeof(float)))));
+std::unique_lock lk(m);
+REQUIRE(cv.wait_for(lk, std::chrono::seconds(5), [&] { return published == 1; }));
+REQUIRE(stage.failed() == 0);
+}
+
+TEST_CASE("preview stage parses offered mrd.samples frames on its own thread"){
+std::mutex m; std::condition_variable cv; std::vector<nlohmann::json> published;
+PreviewStage stage(1000, 32000, 8, [&](nlohmann::json f) { std::scoped_lock lk(m); published.push_back(std::move(f)); cv.notify_all(); });
+std::vector<float> iq(2 * 3 * 4, 1.f);
+const nlohmann::json p{{"idx", 7}, {"channels", 3}, {"n", 4}, {"iq", base64::encode(reinterpret_cast<const char*>(iq.data()), iq.size() * sizeof(float))}};
+const std::string frame = R"({"topic":"mrd.samples","payload":)" + p.dump() + "}";
+REQUIRE(PreviewStage::is_samples(frame));
+REQUIRE(!PreviewStage::is_samples(nlohmann::json{{"topic", "mrd.samples"}, {"payload", p}}.dump()));  // keys sorted: parsed by the marshal
+REQUIRE(stage.offer(std::string(PreviewStage::kFramePrefix) + "\"payload\":{"));  // dropped by the worker
+REQUIRE(stage.offer(frame));
+std::unique_lock lk(m);
+REQUIRE(cv.wait_for(lk, std::chrono::seconds(5), [&] { return !published.empty(); }));
+auto& out = published[0]["payload"];
+REQUIRE(out["idx"] == 7); REQUIRE(out["channels"] == 3); REQUIRE(out["coils"].size() == 3);
+REQUIRE(stage.failed() == 0);
+}
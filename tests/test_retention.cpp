@@ -0,0 +1,230 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "marshal_http.hpp"
+#include "marshal_retention.hpp"
+
+
+TEST_CASE("retention drops the oldest entries beyond max_entries"){
+namespace fs = std::filesystem;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_retention").string();
+fs::remove_all(st.data_dir);
+std::vector<std::string> blobs(5, std::string(10, 'x'));
+for (auto& b : blobs) commit_entries(st, store_blobs(st, {{b.data(), b.size()}}));
+st.retention.max_entries = 2;
+auto r = apply_retention(st);
+REQUIRE(r.entries == 3); REQUIRE(r.bytes == 30);
+size_t n = 0; for_each_index_entry(index_path(st), [&](const nlohmann::json&){ ++n; });
+REQUIRE(n == 2);
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("the age limit keeps entries without a readable ts and everything after them"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_retention_age").string();
+fs::remove_all(st.data_dir); fs::create_directories(fs::path(st.data_dir) / "mrd");
+commit_entries(st, json::array({json{{"ts", "2020-01-01T00:00:00.000Z"}}}));
+{ std::ofstream(index_path(st), std::ios::app) << R"({"path":"x"})" << "\n"; }   // no ts at all
+commit_entries(st, json::array({json{{"ts", "0"}}, json{{"ts", "2020-01-01T00:00:01.000Z"}}}));
+st.retention.max_age = std::chrono::hours(1);
+REQUIRE(apply_retention(st).entries == 1);
+REQUIRE(apply_retention(st).entries == 0);
+size_t n = 0; for_each_index_entry(index_path(st), [&](const nlohmann::json&){ ++n; });
+REQUIRE(n == 3);
+REQUIRE(is_iso8601("2026-01-01T00:00:00.000Z"));
+for (auto bad : {"", "0", "2026-01-01", "2026-01-01 00:00:00"}) REQUIRE(!is_iso8601(bad));
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("cas storage keeps one copy per content and frees it with the last entry"){
+namespace fs = std::filesystem;
+REQUIRE(xxh64::hash("", 0) == 0xEF46DB3751D8E999ull);
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_cas").string();
+fs::remove_all(st.data_dir);
+st.cas = std::make_unique<CasStore>(fs::path(st.data_dir) / "mrd" / "cas");
+std::string a(1000, 'a'), b(1000, 'b');
+for (auto* x : {&a, &a, &b, &a}) commit_entries(st, store_blobs(st, {{x->data(), x->size()}}));
+auto pa = st.cas->path_for(xxh64::hash(a.data(), a.size()));
+REQUIRE(fs::exists(pa)); REQUIRE(st.cas->dup_hits == 2); REQUIRE(st.cas->stored_bytes == 2000);
+st.retention.max_entries = 1;  // the newest entry still refers to a
+auto r = apply_retention(st);
+REQUIRE(r.entries == 3); REQUIRE(r.bytes == 1000);
+REQUIRE(fs::exists(pa)); REQUIRE(!fs::exists(st.cas->path_for(xxh64::hash(b.data(), b.size()))));
+// a restart rebuilds the counts from the index
+st.cas = std::make_unique<CasStore>(fs::path(st.data_dir) / "mrd" / "cas");
+REQUIRE(rebuild_cas(st) == 0); REQUIRE(st.cas->to_json()["blobs"] == 1);
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("the byte limit counts each local blob once"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_retention_bytes").string();
+fs::remove_all(st.data_dir);
+st.cas = std::make_unique<CasStore>(fs::path(st.data_dir) / "mrd" / "cas");
+std::string a(1000, 'a'), b(1000, 'b');
+for (auto* x : {&a, &a, &b}) commit_entries(st, store_blobs(st, {{x->data(), x->size()}}));
+commit_entries(st, json::array({json{{"ts", "2026-01-01T00:00:00.000Z"}, {"size_bytes", 5000}, {"origin", "up"}}}));
+st.retention.max_bytes = 1000;   // a (shared) and b on disk; the replicated entry holds nothing here
+auto r = apply_retention(st);
+REQUIRE(r.entries == 2); REQUIRE(r.bytes == 1000);
+REQUIRE(fs::exists(st.cas->path_for(xxh64::hash(b.data(), b.size()))));
+REQUIRE(apply_retention(st).entries == 0);
+st.retention = {};
+REQUIRE(apply_retention(st).entries == 0);
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("index snapshot restores the in-memory index and replays the tail"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_snapshot").string();
+fs::remove_all(st.data_dir); fs::create_directories(fs::path(st.data_dir) / "mrd");
+auto entry = [](int i){ return json{{"ts", "2026-01-01T00:00:0" + std::to_string(i) + ".000Z"}, {"seq", i}}; };
+for (int i = 1; i <= 3; ++i) commit_entries(st, json::array({entry(i)}));
+REQUIRE(write_index_snapshot(st)); REQUIRE(!write_index_snapshot(st));  // unchanged
+for (int i = 4; i <= 5; ++i) commit_entries(st, json::array({entry(i)}));
+
+MarshalState re; re.data_dir = st.data_dir;
+auto load = begin_index_load(re);
+REQUIRE(load.from_snapshot); REQUIRE(re.index_stats.tail_rows == 2);
+std::string out;
+REQUIRE(re.index_cache.since(entry(3)["ts"], 0, out));  // nothing older can qualify
+REQUIRE(json::parse(out).size() == 2);
+REQUIRE(!re.index_cache.since(entry(3)["ts"], 0, out, true));  // entry 3 itself is still loading
+REQUIRE(re.index_cache.since(entry(4)["ts"], 0, out, true)); REQUIRE(json::parse(out).size() == 2);
+REQUIRE(!re.index_cache.since("0", 0, out));            // needs the rows still loading
+finish_index_load(re, load, {});
+REQUIRE(re.index_cache.since("0", 0, out));
+REQUIRE(json::parse(out) == json::array({entry(1), entry(2), entry(3), entry(4), entry(5)}));
+REQUIRE(re.index_cache.since("0", 2, out)); REQUIRE(json::parse(out).size() == 2);
+REQUIRE(re.index_cache.since(entry(4)["ts"], 0, out, true)); REQUIRE(json::parse(out) == json::array({entry(4), entry(5)}));
+REQUIRE(json::parse(re.index_cache.latest()) == entry(5));
+
+// retention rewrites the index; the cache follows and a stale snapshot is not used
+re.retention.max_entries = 2;
+REQUIRE(apply_retention(re).entries == 3);
+REQUIRE(re.index_cache.since("0", 0, out)); REQUIRE(json::parse(out) == json::array({entry(4), entry(5)}));
+MarshalState again; again.data_dir = st.data_dir;
+REQUIRE(!begin_index_load(again).from_snapshot);
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("index seq continues after a restart, with and without a snapshot"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_index_seq").string();
+fs::remove_all(st.data_dir); fs::create_directories(fs::path(st.data_dir) / "mrd");
+for (int i = 0; i < 3; ++i) commit_entries(st, json::array({json::object()}));
+commit_entries(st, json::array({json{{"ts", "2026-01-01T00:00:00.000Z"}, {"seq", 900}, {"origin", "up"}}}));  // replicated
+auto restart = [&]{ MarshalState re; re.data_dir = st.data_dir; auto load = begin_index_load(re);
+  auto e = commit_entries(re, json::array({json::object()}));   // ingest is served before the load finishes
+  finish_index_load(re, load, {}); commit_entries(re, json::array({json::object()}));
+  REQUIRE(write_index_snapshot(re)); return e[0]["seq"].get<uint64_t>(); };
+REQUIRE(restart() == 4);                                   // scans the index: no snapshot yet
+REQUIRE(restart() == 6);                                   // from the snapshot
+st.index_seq = 10; commit_entries(st, json::array({json::object()}));  // seq 11, after the snapshot
+REQUIRE(restart() == 12);                                  // ... and the tail
+fs::remove(snapshot_path(st));
+REQUIRE(restart() == 14);
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("the in-memory index answers since() for rows in and out of ts order"){
+using nlohmann::json;
+auto rows = [](std::vector<std::string> ts) { IndexCache::Rows out;
+  for (auto& t : ts) { auto r = std::make_shared<IndexRow>();
+    r->line = t.empty() ? json{{"x", 1}}.dump() : json{{"ts", t}}.dump(); if (!t.empty()) r->set_ts(t); out.push_back(r); }
+  return out; };
+auto ts_of = [](const std::string& out) { std::vector<std::string> v;
+  for (auto& e : json::parse(out)) v.push_back(e.value("ts", "-")); return v; };
+IndexCache c; std::string out;
+c.append(rows({"", "a", "b", "b", "c"}), "");
+REQUIRE(c.since("b", 0, out)); REQUIRE(ts_of(out) == std::vector<std::string>{"c"});
+REQUIRE(c.since("b", 0, out, true)); REQUIRE(ts_of(out) == std::vector<std::string>{"b", "b", "c"});
+REQUIRE(c.since("0", 2, out)); REQUIRE(ts_of(out) == std::vector<std::string>{"a", "b"});
+REQUIRE(c.since("d", 0, out)); REQUIRE(out == "[]");
+c.append(rows({"a", "d"}), "");  // replicated from a slower clock
+REQUIRE(c.since("b", 0, out)); REQUIRE(ts_of(out) == std::vector<std::string>{"c", "d"});
+REQUIRE(c.since("0", 0, out, true)); REQUIRE(ts_of(out).size() == 6);
+c.retain({true, true, true, true, true, false});
+REQUIRE(c.since("a", 0, out)); REQUIRE(ts_of(out) == std::vector<std::string>{"b", "b", "c", "d"});
+}
+
+TEST_CASE("the index reads backwards across blocks and stops on request"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+const auto path = fs::temp_directory_path() / "marshal_test_reverse.jsonl";
+{ std::ofstream f(path, std::ios::trunc);
+  for (int i = 0; i < 5000; ++i) f << json{{"seq", i}, {"pad", std::string(i % 97, 'x')}}.dump() << "\n\n";
+  f << "{not json"; }
+std::vector<uint64_t> seen;
+for_each_index_entry_reverse(path, [&](const json& e) { seen.push_back(entry_u64(e, "seq")); return true; });
+REQUIRE(seen.size() == 5000); REQUIRE(seen.front() == 4999); REQUIRE(seen.back() == 0);
+REQUIRE(std::is_sorted(seen.rbegin(), seen.rend()));
+seen.clear();
+for_each_index_entry_reverse(path, [&](const json& e) { seen.push_back(entry_u64(e, "seq")); return seen.size() < 3; });
+REQUIRE(seen == std::vector<uint64_t>{4999, 4998, 4997});
+fs::remove(path);
+}
+
+TEST_CASE("storage recovery and retention skip index fields of the wrong type"){
+namespace fs = std::filesystem;
+using nlohmann::json;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_badfields").string();
+fs::remove_all(st.data_dir);
+st.cas = std::make_unique<CasStore>(fs::path(st.data_dir) / "mrd" / "cas");
+std::string a(100, 'a');
+commit_entries(st, json::array({json{{"ts", 1}, {"hash", 5}, {"size_bytes", "x"}},
+                                json{{"ts", "2026-01-01T00:00:00.000Z"}, {"segment", json::array({1})}, {"offset", -1}},
+                                json{{"ts", "2026-01-01T00:00:01.000Z"}, {"path", 7}}}));
+{ std::ofstream(index_path(st), std::ios::app) << "5\n[1]\n"; }
+commit_entries(st, store_blobs(st, {{a.data(), a.size()}}));
+st.cas = std::make_unique<CasStore>(fs::path(st.data_dir) / "mrd" / "cas");
+st.segments = std::make_unique<SegmentStore>(fs::path(st.data_dir) / "mrd" / "segments", 1 << 16);
+REQUIRE_NOTHROW(recover_segments(st));
+REQUIRE(rebuild_cas(st) == 0); REQUIRE(st.cas->to_json()["blobs"] == 1);
+st.segment_keep = 1;
+REQUIRE_NOTHROW(compact_segments(st));
+st.retention.max_entries = 1;
+REQUIRE(apply_retention(st).entries == 3);
+REQUIRE(fs::exists(st.cas->path_for(xxh64::hash(a.data(), a.size()))));
+fs::remove_all(st.data_dir);
+}
+
+TEST_CASE("cas recovery runs alongside ingest without losing or double counting blobs"){
+namespace fs = std::filesystem;
+MarshalState st; st.data_dir = (fs::temp_directory_path() / "marshal_test_cas_load").string();
+fs::remove_all(st.data_dir);
+const auto root = fs::path(st.data_dir) / "mrd" / "cas";
+st.cas = std::make_unique<CasStore>(root);
+std::string a(1000, 'a'), b(1000, 'b');
+commit_entries(st, store_blobs(st, {{a.data(), a.size()}}));
+{ std::ofstream(fs::path(st.cas->path_for(1)).replace_extension(".mrd.tmp7")) << "left by a crash"; }
+
+MarshalState re; re.data_dir = st.data_dir;
+re.cas = std::make_unique<CasStore>(root);
+auto load = begin_index_load(re);
+commit_entries(re, store_blobs(re, {{b.data(), b.size()}}));   // served before the rebuild
+std::atomic<bool> done{false}; std::atomic<int> failed{0};
+finish_index_load(re, load, {});
+std::thread sweeper([&]{ while (!done) re.cas->sweep(); });   // sweeps racing the uploads below
+for (int i = 0; i < 50; ++i) {
+  std::string c(1 << 20, char(i)); c += std::to_string(i);
+  try { commit_entries(re, store_blobs(re, {{c.data(), c.size()}})); } catch (...) { ++failed; }
+}
+done = true; sweeper.join();
+REQUIRE(failed == 0);
+REQUIRE(re.cas->to_json()["blobs"] == 52);
+REQUIRE(!fs::exists(fs::path(re.cas->path_for(1)).replace_extension(".mrd.tmp7")));
+re.retention.max_entries = 51;   // drops a, whose only reference came from the rebuild
+REQUIRE(apply_retention(re).bytes == 1000);
+re.retention.max_entries = 50;   // drops b: put() counted it and the rebuild did not count it again
+REQUIRE(apply_retention(re).bytes == 1000);
+REQUIRE(!fs::exists(re.cas->path_for(xxh64::hash(b.data(), b.size()))));
+fs::remove_all(st.data_dir);
+}
@@ -0,0 +1,29 @@
+#include <catch2/catch_all.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "marshal_segments.hpp"
+
+namespace fs = std::filesystem;
+
+
+TEST_CASE("segment store packs blobs and rolls when full"){
+auto root = fs::temp_directory_path() / "marshal_test_segments";
+fs::remove_all(root);
+{
+SegmentStore s(root, 16);
+auto a = s.append("0123456789", 10);
+auto b = s.append("abcdef", 6);
+auto c = s.append("xyz", 3);
+REQUIRE(a.segment == b.segment); REQUIRE(b.offset == 10); REQUIRE(b.length == 6);
+REQUIRE(c.segment != a.segment); REQUIRE(c.offset == 0);
+REQUIRE(s.sealed().size() == 1);
+REQUIRE(fs::file_size(a.segment) == 16);
+}
+// sealing on shutdown trims the preallocated tail
+REQUIRE(fs::file_size(root / SegmentStore::name_for(2)) == 3);
+std::ifstream f(root / SegmentStore::name_for(1), std::ios::binary);
+std::string all((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+REQUIRE(all == "0123456789abcdef");
+fs::remove_all(root);
+}
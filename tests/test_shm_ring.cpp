@@ -0,0 +1,70 @@
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "common/shm_ring.hpp"
+
+
+TEST_CASE("shm queue delivers frames from several producers exactly once"){
+auto name = "marshal_test_q_" + std::to_string(::getpid());
+shm::ShmQueue owner(shm::Region::create(name, 64, 64));
+std::thread producers[2]; std::atomic<int> failed{0};
+for (int t = 0; t < 2; ++t)
+producers[t] = std::thread([&, t]{ shm::ShmQueue q(*shm::Region::attach(name)); for (int i = 0; i < 1000; ++i) if (!q.push(std::to_string(t * 1000 + i))) ++failed; });
+std::vector<int> seen(2000, 0); std::string f;
+for (int got = 0; got < 2000;) if (owner.pop(f, std::chrono::milliseconds(100))) { ++seen[std::stoi(f)]; ++got; }
+for (auto& p : producers) p.join();
+REQUIRE(failed == 0);
+for (int c : seen) REQUIRE(c == 1);
+REQUIRE_FALSE(owner.try_push(std::string(65, 'x').data(), 65));
+}
+
+
+TEST_CASE("a push into a full queue gives up on timeout and when the owner is gone"){
+auto name = "marshal_test_full_" + std::to_string(::getpid());
+auto owner = std::make_unique<shm::ShmQueue>(shm::Region::create(name, 2, 64));
+shm::ShmQueue q(*shm::Region::attach(name));
+REQUIRE(q.push("a")); REQUIRE(q.push("b"));
+REQUIRE_FALSE(q.push("c", std::chrono::milliseconds(30)));   // nobody drains it
+owner.reset();                                               // the marshal went away
+auto t0 = std::chrono::steady_clock::now();
+REQUIRE_FALSE(q.push("c", std::chrono::seconds(30)));
+REQUIRE(std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5));
+}
+
+
+TEST_CASE("shm broadcast readers see frames in order and skip when lapped"){
+auto name = "marshal_test_b_" + std::to_string(::getpid());
+shm::ShmBroadcast out(shm::Region::create(name, 4, 64));
+shm::ShmSubscriber live(*shm::Region::attach(name));
+for (int i = 0; i < 3; ++i) out.publish(std::to_string(i));
+std::string f;
+REQUIRE(live.try_next(f)); REQUIRE(f == "0");
+for (int i = 3; i < 10; ++i) out.publish(std::to_string(i));
+REQUIRE(live.try_next(f)); REQUIRE(f == "6");    // 1..5 were overwritten
+REQUIRE(live.lost() == 5);
+shm::ShmSubscriber late(*shm::Region::attach(name), true);
+REQUIRE(late.try_next(f)); REQUIRE(f == "6");
+}
+
+
+TEST_CASE("shm peers notice when the owner recreates the region"){
+auto name = "marshal_test_r_" + std::to_string(::getpid());
+auto out = std::make_unique<shm::ShmBroadcast>(shm::Region::create(name, 4, 16, "0123456789abcdef"));
+shm::ShmSubscriber sub(*shm::Region::attach(name));
+REQUIRE_FALSE(sub.stale());
+REQUIRE(sub.epoch() == "0123456789abcdef");
+REQUIRE_FALSE(out->publish(std::string(17, 'x')));
+REQUIRE(out->slot_bytes() == 16);
+out = std::make_unique<shm::ShmBroadcast>(shm::Region::create(name, 4, 16));   // owner restart
+REQUIRE(sub.stale());
+shm::ShmSubscriber again(*shm::Region::attach(name), true);
+REQUIRE_FALSE(again.stale());
+REQUIRE(again.epoch().empty());
+out->publish(std::string("after"));
+std::string f;
+REQUIRE(again.try_next(f)); REQUIRE(f == "after");
+out.reset();
+REQUIRE(again.stale());
+}
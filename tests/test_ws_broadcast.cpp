@@ -1,2 +1,245 @@
 #include <catch2/catch_all.hpp>
-TEST_CASE("dummy ws test placeholder"){ REQUIRE(true); }
\ No newline at end of file
+TEST_CASE("dummy ws test placeholder"){ REQUIRE(true); }
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "marshal_wslog.hpp"
+
+TEST_CASE("message log replays from the ring and from spill files"){
+namespace fs = std::filesystem;
+auto dir = fs::temp_directory_path() / "marshal_test_wslog";
+fs::remove_all(dir);
+{
+MessageLog log(2, dir);
+for (int i = 0; i < 5; ++i) log.append("mrd.acq", {{"topic","mrd.acq"},{"payload",{{"idx",i}}}});
+log.append("pose", {{"topic","pose"}});
+auto [mem, head] = log.since({"mrd.acq"}, 4);
+REQUIRE(head == 6); REQUIRE(mem.size() == 2); REQUIRE(mem[0]->seq == 4);
+auto [disk, h2] = log.since({"mrd.acq"}, 1);   // evicted from the ring
+REQUIRE(disk.size() == 5); REQUIRE(disk.back()->seq == 5);
+REQUIRE(log.last_k_from({}, 2) == 5);
+}
+std::string epoch;
+{
+MessageLog reopened(2, dir);
+REQUIRE(reopened.head() >= 6);                  // sequences stay monotonic across restarts
+epoch = reopened.epoch();
+}
+REQUIRE(MessageLog(2, dir).epoch() == epoch);   // a clean shutdown keeps the numbering
+REQUIRE(MessageLog(2).epoch() != MessageLog(2).epoch());  // without a log every run numbers anew
+fs::remove_all(dir);
+}
+
+TEST_CASE("a crash before the spill writer flushed starts a new epoch"){
+namespace fs = std::filesystem;
+auto dir = fs::temp_directory_path() / "marshal_test_wslog_crash";
+fs::remove_all(dir);
+std::string epoch;
+{ MessageLog log(2, dir); epoch = log.epoch(); }
+const pid_t pid = ::fork();
+if (pid == 0) {
+  MessageLog log(2, dir);
+  for (int i = 0; i < 5; ++i) log.append("mrd.acq", {{"topic","mrd.acq"}});   // broadcast, still buffered
+  ::_exit(0);                                                                 // no destructor, no flush
+}
+int status = 0;
+REQUIRE(::waitpid(pid, &status, 0) == pid);
+MessageLog re(2, dir);
+REQUIRE(re.epoch() != epoch);
+fs::remove_all(dir);
+}
+
+TEST_CASE("spill replays come in bounded batches that resume at a cursor"){
+namespace fs = std::filesystem;
+auto dir = fs::temp_directory_path() / "marshal_test_wslog_cursor";
+fs::remove_all(dir);
+MessageLog log(1, dir, 256);   // small files: the replay crosses several of them
+for (int i = 0; i < 20; ++i) log.append(i % 2 ? "pose" : "mrd.acq", {{"topic", i % 2 ? "pose" : "mrd.acq"},{"payload",{{"idx",i}}}});
+MessageLog::SpillCursor at;
+std::vector<uint64_t> seqs;
+uint64_t from = 1;
+for (int calls = 0; from <= 20; ++calls) {
+REQUIRE(calls < 10);
+auto [batch, through] = log.since({"mrd.acq"}, from, 3, &at);
+REQUIRE(batch.size() <= 3);
+for (auto& f : batch) seqs.push_back(f->seq);
+if (calls == 0) { REQUIRE(!at.file.empty()); REQUIRE(at.from == through + 1); }
+from = through + 1;
+}
+REQUIRE(seqs == std::vector<uint64_t>{1, 3, 5, 7, 9, 11, 13, 15, 17, 19});
+auto [none, h] = log.since({"mrd.acq"}, 21, 3, &at);
+REQUIRE(none.empty()); REQUIRE(h == 20);
+auto [again, h2] = log.since({"mrd.acq"}, 2, 2, &at);   // behind the cursor: looked up afresh
+REQUIRE(again.size() == 2); REQUIRE(again[0]->seq == 3); REQUIRE(h2 == 5);
+fs::remove_all(dir);
+}
+
+TEST_CASE("spill replays report frames whose file was rolled away"){
+namespace fs = std::filesystem;
+auto dir = fs::temp_directory_path() / "marshal_test_wslog_roll";
+fs::remove_all(dir);
+MessageLog log(1, dir, 256, 2);   // two small files: appends roll the oldest away
+auto add = [&](int n){ for (int i = 0; i < n; ++i) log.append("mrd.acq", {{"topic","mrd.acq"},{"payload",{{"idx",i}}}}); };
+add(6);
+MessageLog::SpillCursor at;
+auto [first, through] = log.since({"mrd.acq"}, 1, 2, &at);   // buffered lines are written out for the replay
+REQUIRE(first.size() == 2); REQUIRE(first[0]->seq == 1); REQUIRE(!at.gap);
+add(20);                                                     // the cursor's file is gone now
+auto [rest, h] = log.since({"mrd.acq"}, through + 1, 100, &at);
+REQUIRE(at.gap); REQUIRE(!rest.empty()); REQUIRE(rest.front()->seq > through + 1); REQUIRE(rest.back()->seq == 26);
+auto [more, h2] = log.since({"mrd.acq"}, h + 1, 100, &at);
+REQUIRE(!at.gap);
+fs::remove_all(dir);
+}
+
+TEST_CASE("message log tells whether a catch-up point is still replayable"){
+MessageLog log(2);
+for (int i = 0; i < 4; ++i) log.append("mrd.acq", {{"topic","mrd.acq"}});
+log.append("pose", {{"topic","pose"}});
+REQUIRE(log.covers({"mrd.acq"}, 3)); REQUIRE(!log.covers({"mrd.acq"}, 2));
+REQUIRE(log.covers({"pose"}, 1));      // nothing of the topic was evicted
+REQUIRE(!log.covers({}, 2)); REQUIRE(log.covers({}, 9));
+}
+
+
+#include "common/trace.hpp"
+
+TEST_CASE("latency histogram percentiles stay within a bucket"){
+trace::Histogram h;
+for (int i = 1; i <= 1000; ++i) h.record(i * 1000);   // 1..1000 us
+REQUIRE(h.count() == 1000);
+auto p50 = h.percentile(0.5), p99 = h.percentile(0.99);
+REQUIRE(p50 >= 500000); REQUIRE(p50 <= 500000 * 5 / 4);
+REQUIRE(p99 >= 990000); REQUIRE(p99 <= 1000000);
+nlohmann::json f{{"topic","mrd.acq"}};
+trace::stamp(f, "m_rx"); REQUIRE_FALSE(f.contains("trace"));   // untraced frames stay untouched
+trace::Sampler every2(2); REQUIRE(every2.maybe_attach(f)); REQUIRE(f["trace"].contains("send"));
+}
+
+
+#include <thread>
+#include <boost/beast/websocket.hpp>
+#include "marshal_ws.hpp"
+
+// A marshal WebSocket endpoint on 127.0.0.1:port, served on its own thread.
+struct WsFixture {
+MarshalState st; boost::asio::io_context ioc; WsServer srv; std::thread io;
+explicit WsFixture(unsigned short port, void (*setup)(MarshalState&) = [](MarshalState&){})
+: srv(ioc, {boost::asio::ip::make_address("127.0.0.1"), port}, (setup(st), st)), io([this]{ ioc.run(); }) {}
+~WsFixture() { ioc.stop(); io.join(); }
+};
+
+struct WsPeer {
+boost::asio::io_context ioc; boost::beast::websocket::stream<boost::asio::ip::tcp::socket> ws{ioc};
+explicit WsPeer(unsigned short port) {
+ws.next_layer().connect({boost::asio::ip::make_address("127.0.0.1"), port});
+ws.handshake("127.0.0.1", "/");
+}
+void send(const std::string& s) { ws.write(boost::asio::buffer(s)); }
+nlohmann::json recv() { boost::beast::flat_buffer b; ws.read(b); return nlohmann::json::parse(boost::beast::buffers_to_string(b.data())); }
+};
+
+TEST_CASE("the chrome trace dump is written off the caller's thread and completed at shutdown"){
+const auto path = std::filesystem::temp_directory_path() / "marshal_test_trace.json";
+{
+trace::ChromeTraceWriter w(path.string());
+for (int i = 0; i < 100; ++i) w.write({{"id", i}, {"send", 1000}, {"m_rx", 2000}, {"m_enq", 2500}});
+REQUIRE(w.dropped() == 0);
+}
+std::ifstream f(path);
+std::string text((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+text.erase(text.size() - 2); text += "]";  // the trailing comma is allowed by the format, not by json
+auto events = nlohmann::json::parse(text);
+REQUIRE(events.size() == 200); REQUIRE(events[199]["args"]["id"] == 99); REQUIRE(events[0]["dur"] == 1.0);
+std::filesystem::remove(path);
+}
+
+TEST_CASE("malformed client frames are rejected without stopping the marshal"){
+WsFixture m(18191);
+WsPeer p(18191);
+p.send(R"({"op":5})");
+REQUIRE(p.recv()["op"] == 5);   // not a known op: forwarded verbatim
+p.send(R"({"op":"subscribe","from_seq":"3"})");
+REQUIRE(p.recv()["topic"] == "ws.error");
+p.send(R"({"op":"subscribe","last":-1})");
+REQUIRE(p.recv()["topic"] == "ws.error");
+p.send(R"({"op":"subscribe","topics":["a"],"from_seq":1})");
+REQUIRE(p.recv()["topic"] == "ws.subscribed");
+p.send(R"({"topic":"a","payload":1})");
+auto f = p.recv(); REQUIRE(f["topic"] == "a"); REQUIRE(f["seq"] == 1);
+p.send(R"({"op":"subscribe","topics":["a"],"from_seq":50})");   // a cursor from another epoch
+f = p.recv(); REQUIRE(f["topic"] == "ws.gap"); REQUIRE(f["payload"]["head_seq"] == 1);
+REQUIRE(f["payload"]["epoch"] == m.srv.log().epoch());
+f = p.recv(); REQUIRE(f["topic"] == "ws.subscribed"); REQUIRE(f["payload"]["head_seq"] == 1);
+}
+
+TEST_CASE("frames with unreadable trace contexts are delivered untraced"){
+WsFixture m(18192);
+WsPeer p(18192);
+p.send(R"({"op":"subscribe","topics":["x"]})");
+REQUIRE(p.recv()["topic"] == "ws.subscribed");
+p.send(R"({"op":"trace","trace":{"m_enq":"a","c_rx":1}})");
+p.send(R"({"op":"trace","trace":[1]})");
+p.send(R"({"topic":"x","trace":1})");
+auto f = p.recv(); REQUIRE(f["seq"] == 1); REQUIRE_FALSE(f.contains("trace"));
+p.send(R"({"topic":"x","trace":{"send":"0"}})");
+f = p.recv(); REQUIRE(f["seq"] == 2); REQUIRE_FALSE(f.contains("trace"));
+p.send(R"({"topic":"x","trace":{"id":1,"send":5}})");
+f = p.recv(); REQUIRE(f["trace"]["m_enq"].is_number_integer());
+REQUIRE(m.st.trace_stats.hops[trace::SendToRx].count() == 1);
+REQUIRE(m.st.trace_stats.hops[trace::FanoutToConsumer].count() == 0);
+nlohmann::json t{{"m_enq", 1}, {"c_rx", "late"}};
+REQUIRE_FALSE(trace::valid(t)); REQUIRE(trace::at(t, "m_enq") == 1); REQUIRE_FALSE(trace::at(t, "c_rx"));
+}
+
+TEST_CASE("only arrays of frames are unpacked as batches"){
+WsFixture m(18193);
+WsPeer p(18193);
+p.send(R"([{"topic":"a","payload":1},{"topic":"b","payload":2}])");
+auto f = p.recv(); REQUIRE(f["topic"] == "a"); REQUIRE(f["seq"] == 1);
+f = p.recv(); REQUIRE(f["topic"] == "b"); REQUIRE(f["seq"] == 2);
+p.send(R"([1,2,3])");
+REQUIRE(p.recv() == nlohmann::json::array({1, 2, 3}));
+p.send(R"([{"topic":"a","payload":3},"x"])");
+f = p.recv(); REQUIRE(f.is_array()); REQUIRE(f.size() == 2);
+REQUIRE(m.srv.log().head() == 2);
+}
+
+TEST_CASE("mrd.samples feed the preview off the network thread and are not logged"){
+WsFixture m(18194);
+WsPeer p(18194);
+p.send(R"({"op":"subscribe","topics":["mrd.preview"]})");
+REQUIRE(p.recv()["topic"] == "ws.subscribed");
+std::vector<float> iq(2 * 2 * 8, 1.f);
+const auto b64 = base64::encode(iq.data(), iq.size() * sizeof(float));
+// sorted keys put the topic last, so these two are parsed on the network thread
+p.send(nlohmann::json{{"topic", "mrd.samples"}, {"payload", {{"idx", 0}, {"channels", "2"}, {"n", 8}, {"iq", b64}}}}.dump());
+p.send(nlohmann::json{{"topic", "mrd.samples"}, {"payload", {{"idx", 1}, {"channels", -2}, {"n", 8}, {"iq", b64}}}}.dump());
+p.send(R"({"topic":"mrd.samples","payload":)" + nlohmann::json{{"idx", 2}, {"channels", 2}, {"n", 8}, {"iq", b64}}.dump() + "}");
+auto f = p.recv();
+REQUIRE(f["topic"] == "mrd.preview"); REQUIRE(f["payload"]["idx"] == 2); REQUIRE(f["payload"]["acqs"] == 1);
+REQUIRE(f["payload"]["coils"].size() == 2); REQUIRE(f["seq"] == 1);  // the samples were not logged
+REQUIRE(m.srv.log().head() == 1);
+}
+
+TEST_CASE("a deep replay from the spill files arrives complete and in order"){
+std::filesystem::remove_all(std::filesystem::temp_directory_path() / "marshal_test_wsreplay");
+WsFixture m(18195, [](MarshalState& st){
+st.data_dir = (std::filesystem::temp_directory_path() / "marshal_test_wsreplay").string();
+st.ws_log = true; st.ws_ring = 2; st.ws_max_queue = 4; });
+WsPeer p(18195);
+for (int i = 0; i < 40; ++i) p.send(nlohmann::json{{"topic", i % 4 ? "a" : "b"}, {"payload", i}}.dump());
+while (m.srv.log().head() < 40) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+WsPeer q(18195);
+q.send(R"({"op":"subscribe","topics":["a"],"from_seq":1})");
+for (int i = 0; i < 40; ++i) {
+if (i % 4 == 0) continue;
+auto f = q.recv(); REQUIRE(f["topic"] == "a"); REQUIRE(f["seq"] == i + 1);
+}
+auto done = q.recv();
+REQUIRE(done["topic"] == "ws.subscribed"); REQUIRE(done["payload"]["replayed"] == 30); REQUIRE(done["payload"]["head_seq"] == 40);
+std::filesystem::remove_all(m.st.data_dir);
+}